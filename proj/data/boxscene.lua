@@ -1,4 +1,3 @@
-require('readobj')
 
 scene = gr.node('scene')
 
@@ -16,14 +15,14 @@ boxParent = gr.node('boxContainer')
 scene:add_child(boxParent)
 boxParent:translate(-roomSize / 2, -roomSize / 2, 0)
 
-left = gr.mesh('left', readobj('mymesh.obj'))
+left = gr.mesh('left', gr.readobj('mymesh.obj'))
 boxParent:add_child(left)
 left:set_material(green)
 left:rotate('Y', 90)
 left:scale(roomSize, roomSize, 1)
 left:scale(4, 1, 1)
 
-right = gr.mesh('right', readobj('mymesh.obj'))
+right = gr.mesh('right', gr.readobj('mymesh.obj'))
 boxParent:add_child(right)
 right:set_material(blue)
 right:translate(roomSize, 0, -4 * roomSize)
@@ -31,20 +30,20 @@ right:rotate('Y', -90)
 right:scale(roomSize, roomSize, 1)
 right:scale(4, 1, 1)
 
-back = gr.mesh('back', readobj('mymesh.obj'))
+back = gr.mesh('back', gr.readobj('mymesh.obj'))
 boxParent:add_child(back)
 back:set_material(red)
 back:translate(0, 0, -4 * roomSize)
 back:scale(roomSize, roomSize, 1)
 
-floor = gr.mesh('floor', readobj('mymesh.obj'))
+floor = gr.mesh('floor', gr.readobj('mymesh.obj'))
 boxParent:add_child(floor)
 floor:set_material(white)
 floor:rotate('X', -90)
 floor:scale(roomSize, roomSize, 1)
 floor:scale(1, 4, 1)
 
-roof = gr.mesh('roof', readobj('mymesh.obj'))
+roof = gr.mesh('roof', gr.readobj('mymesh.obj'))
 boxParent:add_child(roof)
 roof:set_material(black)
 roof:translate(0, roomSize, -4 * roomSize)
@@ -52,7 +51,7 @@ roof:rotate('X', 90)
 roof:scale(roomSize, roomSize, 1)
 roof:scale(1, 4, 1)
 
-front = gr.mesh('front', readobj('mymesh.obj'))
+front = gr.mesh('front', gr.readobj('mymesh.obj'))
 boxParent:add_child(front)
 front:set_material(purple)
 front:translate(roomSize, 0, 0)
@@ -1,4 +1,3 @@
-require('readobj')
 
 scene = gr.node('scene')
 
@@ -16,38 +15,38 @@ boxParent = gr.node('boxContainer')
 scene:add_child(boxParent)
 boxParent:translate(-roomSize / 2, -roomSize / 2, 0)
 
-left = gr.mesh('left', readobj('mymesh.obj'))
+left = gr.mesh('left', gr.readobj('mymesh.obj'))
 left:set_material(green)
 left:rotate('Y', 90)
 left:scale(roomSize, roomSize, 1)
 left:scale(1, 1, 1)
 
-right = gr.mesh('right', readobj('mymesh.obj'))
+right = gr.mesh('right', gr.readobj('mymesh.obj'))
 right:set_material(blue)
 right:translate(roomSize, 0, -roomSize)
 right:rotate('Y', -90)
 right:scale(roomSize, roomSize, 1)
 right:scale(1, 1, 1)
 
-back = gr.mesh('back', readobj('mymesh.obj'))
+back = gr.mesh('back', gr.readobj('mymesh.obj'))
 back:set_material(red)
 back:translate(0, 0, -roomSize)
 back:scale(roomSize, roomSize, 1)
 
-floor = gr.mesh('floor', readobj('mymesh.obj'))
+floor = gr.mesh('floor', gr.readobj('mymesh.obj'))
 floor:set_material(white)
 floor:rotate('X', -90)
 floor:scale(roomSize, roomSize, 1)
 floor:scale(1, 1, 1)
 
-roof = gr.mesh('roof', readobj('mymesh.obj'))
+roof = gr.mesh('roof', gr.readobj('mymesh.obj'))
 roof:set_material(black)
 roof:translate(0, roomSize, -roomSize)
 roof:rotate('X', 90)
 roof:scale(roomSize, roomSize, 1)
 roof:scale(1, 1, 1)
 
-front = gr.mesh('front', readobj('mymesh.obj'))
+front = gr.mesh('front', gr.readobj('mymesh.obj'))
 front:set_material(purple)
 front:translate(roomSize, 0, 0)
 front:rotate('Y', 180)
@@ -45,7 +45,7 @@ handle:scale(0.05, 0.05, 1.5)
 --
 -- Monkey head on wall
 --
-suzy = gr.mesh('suzy', readobj('suzy.obj'))
+suzy = gr.mesh('suzy', gr.readobj('suzy.obj'))
 scene:add_child(suzy)
 suzy:set_material(gold)
 suzy:translate(LEFT, BOTTOM/2, BACK)
@@ -74,7 +74,7 @@ antFood:rotate('X', -32)
 antFood:rotate('Y', 45)
 antFood:scale(0.053, 0.053, 0.063)
 
-ant = gr.mesh('ant', readobj('ant.obj'))
+ant = gr.mesh('ant', gr.readobj('ant.obj'))
 antScene:add_child(ant)
 ant:set_material(antM)
 ant:translate(0.55, 0.4, .3)
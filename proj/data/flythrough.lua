@@ -0,0 +1,35 @@
+-- Flies the camera down the box from adaptive.lua, one frame at a time.
+-- Turn the frames into a video with e.g.
+--   ffmpeg -i fly%03d.png fly.mp4
+require('boxscene')
+
+grey = gr.material({0.2, 0.2, 0.2}, {0, 0, 0}, 0, 1)
+bw = gr.function_material("bw_squares", {0, 0, 0}, 25, 1)
+pink = gr.material({0.75, 0, 0.75}, {0, 0, 0}, 1, 1)
+
+sphere = gr.sphere('sphere')
+sphere:set_material(pink)
+sphere:translate(0, -roomSize / 2 + 2, -roomSize * 4 + 4)
+scene:add_child(sphere)
+
+floor:set_material(grey)
+back:set_material(bw)
+roof:set_material(grey)
+right:set_material(grey)
+left:set_material(grey)
+front:set_material(grey)
+
+FRAMES = 48
+
+-- Start at the front of the box and glide most of the way to the back,
+-- drifting from side to side
+function camera(frame)
+  local t = (frame - 1) / (FRAMES - 1)
+  local eye = {2 * math.sin(t * math.pi * 2), -roomSize / 2 + 2.5,
+               -roomSize * 3 * t - 1}
+  return eye, {0, -0.1, -1}, {0, 1, 0}, 50
+end
+
+SIZE = 256
+gr.render_sequence(scene, 'fly%03d.png', SIZE, SIZE, FRAMES, camera,
+                   {0.4, 0.4, 0.4}, {frontTopLeft, backTopRight})
@@ -1,5 +1,3 @@
-require('readobj')
-
 scene = gr.node('scene')
 
 grey = gr.material({0.2, 0.2, 0.2}, {0, 0, 0}, 0, 1)
@@ -7,13 +5,13 @@ bw = gr.function_material("bw_squares", {0, 0, 0}, 25, 1)
 bluegreen = gr.function_material("blue_green_squares", {0, 0, 0}, 25, 1)
 mirror = gr.material({.1, .1, .1}, {0.6, 0.6, 0.6}, 1e10, 1)
 
-back = gr.mesh('back', readobj('mymesh.obj'))
+back = gr.mesh('back', gr.readobj('mymesh.obj'))
 back:translate(-10, -10, -20)
 back:scale(20, 20, 1)
 back:set_material(grey)
 scene:add_child(back)
 
-floor = gr.mesh('floor', readobj('mymesh.obj'))
+floor = gr.mesh('floor', gr.readobj('mymesh.obj'))
 floor:translate(-10, 0, 0)
 floor:rotate('X', -90)
 floor:scale(20, 20, 1)
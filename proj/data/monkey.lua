@@ -1,10 +1,8 @@
-require('readobj')
-
 scene = gr.node('scene')
 
 blue = gr.material({0.25, 0.33, 0.88}, {0.5, 0.4, 0.8}, 25, 1)
 
-suzanne = gr.mesh('suzanne', readobj('suzanne.obj'))
+suzanne = gr.mesh('suzanne', gr.readobj('suzanne.obj'))
 scene:add_child(suzanne)
 suzanne:translate(0, 0, 0)
 suzanne:set_material(blue)
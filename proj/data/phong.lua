@@ -4,7 +4,7 @@ s2=gr.node('s2')
 grey = gr.material({0.2, 0.2, 0.2}, {0, 0, 0}, 0, 1)
 yellow = gr.material({0.75, 0.75, 0}, {0, 0, 0}, 15, 1)
 
-gourd = gr.mesh('gourd', readobj('gourd.obj'))
+gourd = gr.mesh('gourd', gr.readobj('gourd.obj'))
 gourd:set_material(yellow)
 gourd:translate(0, 0, 4)
 gourd:rotate('Z', 90)
@@ -1,6 +1,8 @@
 #include "Antialiaser.hpp"
 
+#include <algorithm>
 #include <cmath>
+#include <iostream>
 
 #include "image.hpp"
 #include "RayTracer.hpp"
@@ -30,8 +32,78 @@ Colour average(const std::vector<Colour>& colours) {
   return res / colours.size();
 }
 
+const size_t CACHE_SHARDS = 64;
+
 } // Anonymous
 
+Antialiaser::Antialiaser(const RayTracer* rt_, const Image* image_,
+                         double tol, int depth)
+    : rt(rt_), image(image_), tolerance(tol), maxDepth(depth),
+      latticeScale(std::pow(2.0, std::max(depth, 0))), cache(CACHE_SHARDS),
+      cacheForgotten(0), cachePeak(0) {}
+
+Colour Antialiaser::sample(double x, double y, CacheCounts* counts) const {
+  // Every sub-sample lies exactly on the lattice, so rounding only guards
+  // against representation error
+  const auto lx = (uint64_t) std::llround(x * latticeScale);
+  const auto ly = (uint64_t) std::llround(y * latticeScale);
+  const uint64_t key = (lx << 32) | (ly & 0xffffffff);
+  auto& shard = cache[(lx * 31 + ly) % cache.size()];
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.samples.find(key);
+    if (it != shard.samples.end()) {
+      if (counts) counts->hits += 1;
+      return it->second;
+    }
+  }
+
+  // Trace without holding the lock. Two threads may both trace the same
+  // point, which costs a ray but is otherwise harmless.
+  if (counts) counts->misses += 1;
+  const Colour colour = rt->pixelColour(x, y);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  shard.samples.emplace(key, colour);
+  return colour;
+}
+
+void Antialiaser::forgetAbove(unsigned y) const {
+  const auto limit = (uint64_t) std::llround(y * latticeScale);
+  uint64_t kept = 0;
+  uint64_t forgotten = 0;
+  for (auto& shard : cache) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    kept += shard.samples.size();
+    for (auto it = shard.samples.begin(); it != shard.samples.end();) {
+      if ((it->first & 0xffffffff) < limit) {
+        it = shard.samples.erase(it);
+        forgotten += 1;
+      }
+      else {
+        ++it;
+      }
+    }
+  }
+  cacheForgotten.fetch_add(forgotten, std::memory_order_relaxed);
+  uint64_t peak = cachePeak;
+  while (kept > peak && !cachePeak.compare_exchange_weak(peak, kept)) {}
+}
+
+void Antialiaser::printCacheStats(const CacheCounts& counts) const {
+  const uint64_t hits = counts.hits;
+  const uint64_t lookups = hits + counts.misses;
+  uint64_t kept = 0;
+  for (auto& shard : cache) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    kept += shard.samples.size();
+  }
+  std::cerr << "Antialiasing cache: " << hits << " hits of " << lookups
+            << " sub-samples ("
+            << (lookups ? 100.0 * hits / lookups : 0) << "%); at most "
+            << std::max<uint64_t>(cachePeak, kept) << " kept at once, "
+            << cacheForgotten << " forgotten as rows finished" << std::endl;
+}
+
 Colour Antialiaser::Pixel::colour() const {
   return colours[0];
 }
@@ -49,21 +121,38 @@ bool Antialiaser::shouldAntialias(const Antialiaser::Pixel& pixel) const {
   return false;
 }
 
-Colour Antialiaser::antialias(unsigned x, unsigned y) const {
-  // Antialias it all.
-  // First, determine if there is too large a difference
+Antialiaser::Pixel Antialiaser::cornerPixel(unsigned x, unsigned y) const {
   std::vector<Colour> colours = {
     getPixelColour(*image, x, y),
     getPixelColour(*image, x + 1, y),
     getPixelColour(*image, x, y + 1),
     getPixelColour(*image, x + 1, y + 1),
   };
-  return getColour(Antialiaser::Pixel(x, y, std::move(colours)));
+  return Antialiaser::Pixel(x, y, std::move(colours));
+}
+
+Colour
+Antialiaser::antialias(unsigned x, unsigned y, int* depthReached,
+                       CacheCounts* counts) const {
+  // Antialias it all.
+  // First, determine if there is too large a difference
+  if (depthReached) *depthReached = 0;
+  return getColour(cornerPixel(x, y), 0, depthReached, counts);
+}
+
+bool Antialiaser::needsRefinement(unsigned x, unsigned y) const {
+  return maxDepth > 0 && shouldAntialias(cornerPixel(x, y));
+}
+
+Colour Antialiaser::unrefined(unsigned x, unsigned y) const {
+  return cornerPixel(x, y).colour();
 }
 
 Colour
-Antialiaser::getColour(const Antialiaser::Pixel& pixel, int depth) const {
+Antialiaser::getColour(const Antialiaser::Pixel& pixel, int depth,
+                       int* deepest, CacheCounts* counts) const {
   // Get colour for a pixel
+  if (deepest) *deepest = std::max(*deepest, depth);
   if (depth >= maxDepth || !shouldAntialias(pixel)) return pixel.colour();
   // Uncomment to view which pixels are getting antialiased
   //return Colour(1, 0, 0);
@@ -71,19 +160,21 @@ Antialiaser::getColour(const Antialiaser::Pixel& pixel, int depth) const {
   // Split into sub-pixels
   std::vector<Antialiaser::Pixel> subPixels;
 
-  double dist = std::pow(0.5, depth);
-  Colour top = rt->pixelColour(pixel.x + dist, pixel.y);
-  Colour mid = rt->pixelColour(pixel.x + dist, pixel.y + dist);
-  Colour left = rt->pixelColour(pixel.x, pixel.y + dist);
-  Colour right = rt->pixelColour(pixel.x + 2*dist, pixel.y + dist);
-  Colour bottom = rt->pixelColour(pixel.x + dist, pixel.y + 2*dist);
+  // Pixels at this depth are 0.5^depth across, so half of that gets to the
+  // middle of one
+  double dist = std::pow(0.5, depth + 1);
+  Colour top = sample(pixel.x + dist, pixel.y, counts);
+  Colour mid = sample(pixel.x + dist, pixel.y + dist, counts);
+  Colour left = sample(pixel.x, pixel.y + dist, counts);
+  Colour right = sample(pixel.x + 2*dist, pixel.y + dist, counts);
+  Colour bottom = sample(pixel.x + dist, pixel.y + 2*dist, counts);
 
   // Top left
   subPixels.emplace_back(pixel.x, pixel.y, std::vector<Colour>(
                          {pixel.colours[0], top, left, mid}));
   // Top right
   subPixels.emplace_back(pixel.x + dist, pixel.y, std::vector<Colour>(
-                         {top, pixel.colours[1], top, mid, right}));
+                         {top, pixel.colours[1], mid, right}));
   // Bottom left
   subPixels.emplace_back(pixel.x, pixel.y + dist, std::vector<Colour>(
                          {left, mid, pixel.colours[2], bottom}));
@@ -93,7 +184,7 @@ Antialiaser::getColour(const Antialiaser::Pixel& pixel, int depth) const {
   // Now we just need to average them all
   std::vector<Colour> colours;
   for (const auto& px : subPixels) {
-    colours.emplace_back(getColour(px, depth + 1));
+    colours.emplace_back(getColour(px, depth + 1, deepest, counts));
   }
 
   return average(colours);
@@ -1,7 +1,11 @@
 #pragma once
 
-#include <vector>
+#include <atomic>
+#include <cstdint>
 #include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 #include "algebra.hpp"
 
@@ -10,10 +14,29 @@ class RayTracer;
 
 class Antialiaser {
  public:
+  // Sub-samples found already traced, and those that had to be traced
+  struct CacheCounts {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+  };
+
   Antialiaser(const RayTracer* rt_, const Image* image_,
-              double tol=.02, int depth=1)
-              : rt(rt_), image(image_), tolerance(tol), maxDepth(depth) {}
-  Colour antialias(unsigned x, unsigned y) const;
+              double tol=.02, int depth=1);
+  // Safe to call from several threads at once. If given, depthReached is
+  // set to how many times the pixel was split along the deepest branch,
+  // and the pixel's sub-samples are added to counts.
+  Colour antialias(unsigned x, unsigned y, int* depthReached = nullptr,
+                   CacheCounts* counts = nullptr) const;
+  // Whether antialias(x, y) would trace any more rays
+  bool needsRefinement(unsigned x, unsigned y) const;
+  // The colour antialias(x, y) starts from, without tracing anything
+  Colour unrefined(unsigned x, unsigned y) const;
+  // Drop the sub-samples kept above row y. Pixels above it must be done:
+  // they are the only ones that could use them.
+  void forgetAbove(unsigned y) const;
+  // Print how often sub-samples were found already traced, from the counts
+  // of every pixel, and how many were kept at once
+  void printCacheStats(const CacheCounts& counts) const;
 
  private:
   const RayTracer* const rt;
@@ -21,6 +44,22 @@ class Antialiaser {
   const double tolerance;
   const int maxDepth;
 
+  // Sub-samples are shared between neighbouring pixels and depths, so each
+  // one is kept, keyed by its position on the finest lattice. The cache is
+  // split into shards with their own locks to keep threads from queueing.
+  struct CacheShard {
+    std::mutex mutex;
+    std::unordered_map<uint64_t, Colour> samples;
+  };
+  // Lattice points per pixel along each axis
+  const double latticeScale;
+  mutable std::vector<CacheShard> cache;
+  // Sub-samples dropped by forgetAbove, and the most it found kept
+  mutable std::atomic<uint64_t> cacheForgotten;
+  mutable std::atomic<uint64_t> cachePeak;
+  // The colour at (x, y), traced only if no one has yet
+  Colour sample(double x, double y, CacheCounts* counts) const;
+
   struct Pixel {
     // A pixel consists of a top-left point, a distance and four colours, which
     // are at the corners.  0---1
@@ -35,5 +74,8 @@ class Antialiaser {
   };
 
   bool shouldAntialias(const Pixel& pixel) const;
-  Colour getColour(const Pixel& pixel, int depth = 0) const;
+  Pixel cornerPixel(unsigned x, unsigned y) const;
+  // Raises *deepest, if given, to the deepest depth it gets to
+  Colour getColour(const Pixel& pixel, int depth, int* deepest,
+                   CacheCounts* counts) const;
 };
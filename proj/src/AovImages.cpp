@@ -0,0 +1,223 @@
+#include "AovImages.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+#include "HitRecord.hpp"
+#include "image.hpp"
+#include "Ray.hpp"
+
+namespace {
+
+#if defined(__x86_64__) || defined(__i386__)
+const char* const TIME_UNIT = "cycles";
+
+uint64_t now() {
+  return __rdtsc();
+}
+#else
+const char* const TIME_UNIT = "ns";
+
+uint64_t now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+// Black through blue, cyan, green and yellow to red, for t in [0, 1]
+Colour heat(double t) {
+  static const double stops[][3] = {
+    {0, 0, 0}, {0, 0, 1}, {0, 1, 1}, {0, 1, 0}, {1, 1, 0}, {1, 0, 0},
+  };
+  const int last = sizeof(stops) / sizeof(stops[0]) - 1;
+  const double at = std::min(std::max(t, 0.0), 1.0) * last;
+  const int i = std::min((int) at, last - 1);
+  const double f = at - i;
+  return Colour(stops[i][0] + f * (stops[i + 1][0] - stops[i][0]),
+                stops[i][1] + f * (stops[i + 1][1] - stops[i][1]),
+                stops[i][2] + f * (stops[i + 1][2] - stops[i][2]));
+}
+
+void setPixel(Image* image, uint32_t x, uint32_t y, const Colour& colour) {
+  (*image)(x, y, 0) = colour.R();
+  (*image)(x, y, 1) = colour.G();
+  (*image)(x, y, 2) = colour.B();
+}
+
+// Counts as a heat map, scaled so the largest is red
+template <typename T>
+Image heatMap(const std::vector<T>& counts, uint32_t width, uint32_t height,
+              T* largest) {
+  *largest = counts.empty()
+                 ? 0 : *std::max_element(counts.begin(), counts.end());
+  Image image(width, height, 3);
+  if (*largest == 0) return image;
+  for (uint32_t y = 0; y < height; ++y) {
+    for (uint32_t x = 0; x < width; ++x) {
+      setPixel(&image, x, y,
+               heat(counts[y * width + x] / (double) *largest));
+    }
+  }
+  return image;
+}
+
+} // Anonymous
+
+const char* const AovImages::NAMES[AovImages::KINDS] = {
+  "rays", "time", "aa", "cells", "depth", "normal",
+};
+
+bool AovImages::parse(const std::string& list, uint32_t* kinds) {
+  *kinds = 0;
+  std::istringstream names(list);
+  std::string name;
+  while (std::getline(names, name, ',')) {
+    const auto found = std::find(NAMES, NAMES + KINDS, name);
+    if (found == NAMES + KINDS) {
+      std::cerr << "Unknown image kind: " << name << " (expected";
+      for (const auto known : NAMES) {
+        std::cerr << " " << known;
+      }
+      std::cerr << ")" << std::endl;
+      return false;
+    }
+    *kinds |= 1u << (found - NAMES);
+  }
+  return true;
+}
+
+AovImages::AovImages(uint32_t kinds_, uint32_t width_, uint32_t height_)
+    : kinds(kinds_), width(width_), height(height_) {
+  const size_t size = width * height;
+  if (has(RAYS)) rays.resize(size, 0);
+  if (has(TIME)) times.resize(size, 0);
+  if (has(AA_DEPTH)) aaDepths.resize(size, 0);
+  if (has(CELLS)) cells.resize(size, 0);
+  if (has(DEPTH) || has(NORMAL)) hits.resize(size, 0);
+  if (has(DEPTH)) depths.resize(size, 0);
+  if (has(NORMAL)) normals.resize(size);
+}
+
+void AovImages::add(uint32_t x, uint32_t y, const Tally& tally,
+                    uint64_t time) {
+  const size_t i = y * width + x;
+  if (!rays.empty()) rays[i] += tally.rays;
+  if (!times.empty()) times[i] += time;
+  if (!cells.empty()) cells[i] += tally.cells;
+  if (!hits.empty()) hits[i] += tally.hits;
+  if (!depths.empty()) depths[i] += tally.depth;
+  if (!normals.empty()) normals[i] = normals[i] + tally.normal;
+}
+
+void AovImages::setAaDepth(uint32_t x, uint32_t y, uint32_t depth) {
+  if (!aaDepths.empty()) aaDepths[y * width + x] = depth;
+}
+
+void AovImages::save(const std::string& filename) const {
+  const std::string ending = ".png";
+  std::string base = filename;
+  if (base.size() >= ending.size() &&
+      base.compare(base.size() - ending.size(), ending.size(), ending) == 0) {
+    base.erase(base.size() - ending.size());
+  }
+
+  for (int kind = 0; kind < KINDS; ++kind) {
+    if (!has((Kind) kind)) continue;
+    const std::string path = base + "." + NAMES[kind] + ending;
+    Image image;
+    std::ostringstream scale;
+    if (kind == RAYS || kind == TIME || kind == CELLS) {
+      const auto& counts = kind == RAYS ? rays : kind == TIME ? times : cells;
+      uint64_t largest;
+      image = heatMap(counts, width, height, &largest);
+      scale << "red is " << largest << " "
+            << (kind == RAYS ? "rays" : kind == TIME ? TIME_UNIT : "cells");
+    }
+    else if (kind == AA_DEPTH) {
+      uint32_t largest;
+      image = heatMap(aaDepths, width, height, &largest);
+      scale << "red is " << largest;
+    }
+    else if (kind == DEPTH) {
+      // Nearest white, farthest dark grey, and nothing hit black
+      double nearest = std::numeric_limits<double>::infinity();
+      double farthest = 0;
+      for (size_t i = 0; i < hits.size(); ++i) {
+        if (hits[i] == 0) continue;
+        nearest = std::min(nearest, depths[i] / hits[i]);
+        farthest = std::max(farthest, depths[i] / hits[i]);
+      }
+      image = Image(width, height, 3);
+      const double range = std::max(farthest - nearest, 1e-9);
+      for (uint32_t y = 0; y < height; ++y) {
+        for (uint32_t x = 0; x < width; ++x) {
+          const size_t i = y * width + x;
+          if (hits[i] == 0) continue;
+          const double far = (depths[i] / hits[i] - nearest) / range;
+          setPixel(&image, x, y, Colour(1 - 0.9 * far));
+        }
+      }
+      scale << "white is " << (farthest > 0 ? nearest : 0) << ", grey is "
+            << farthest << " away";
+    }
+    else {
+      // Each axis from -1 to 1 mapped to 0 to 1, and nothing hit black
+      image = Image(width, height, 3);
+      for (uint32_t y = 0; y < height; ++y) {
+        for (uint32_t x = 0; x < width; ++x) {
+          auto normal = normals[y * width + x];
+          if (hits[y * width + x] == 0 || normal.length2() == 0) continue;
+          normal.normalize();
+          setPixel(&image, x, y, Colour((normal[0] + 1) / 2,
+                                        (normal[1] + 1) / 2,
+                                        (normal[2] + 1) / 2));
+        }
+      }
+      scale << "world space";
+    }
+    if (image.savePng(path)) {
+      std::cerr << "Saved " << path << " (" << scale.str() << ")"
+                << std::endl;
+    }
+    else {
+      std::cerr << "Could not save " << path << std::endl;
+    }
+  }
+}
+
+namespace aov {
+
+thread_local AovImages::Tally* tally = nullptr;
+
+void recordFirstHit(const Ray& ray, const HitRecord* hitRecord) {
+  tally->awaitingHit = false;
+  if (!hitRecord) return;
+  tally->hits += 1;
+  tally->depth += (hitRecord->point - ray.start).length();
+  auto normal = hitRecord->norm;
+  normal.normalize();
+  tally->normal = tally->normal + normal;
+}
+
+PixelScope::PixelScope(AovImages* images_, uint32_t x_, uint32_t y_)
+    : images(images_ && images_->contains(x_, y_) ? images_ : nullptr),
+      x(x_), y(y_), outer(tally) {
+  if (!images) return;
+  tally = &mine;
+  start = now();
+}
+
+PixelScope::~PixelScope() {
+  if (!images) return;
+  images->add(x, y, mine, now() - start);
+  tally = outer;
+}
+
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "algebra.hpp"
+
+class HitRecord;
+class Ray;
+
+// Extra images of a render, saved beside it, showing what each pixel cost
+// and what it first hit: for finding what makes a scene slow, and tuning
+// its settings.
+//
+// Only the kinds asked for have buffers. Work is tallied into the pixel it
+// was done for by the thread doing it (see aov::PixelScope), and each pixel
+// is only worked on by one thread at a time, so tallying takes no locks.
+class AovImages {
+ public:
+  enum Kind {
+    // Rays of every kind traced
+    RAYS,
+    // Time spent tracing, in cycles where the processor can count them
+    TIME,
+    // How deep antialiasing went, or for sampled renders the samples taken
+    AA_DEPTH,
+    // Uniform grid cells visited
+    CELLS,
+    // Distance to what the camera rays hit, and its normal, averaged
+    DEPTH,
+    NORMAL,
+    KINDS
+  };
+  // As given to --aov, and put before .png in the file names
+  static const char* const NAMES[KINDS];
+
+  // Turn a list of names like "rays,time" into a set of kinds, a bit
+  // (1 << kind) each. Returns false, having said why, on an unknown name.
+  static bool parse(const std::string& list, uint32_t* kinds);
+
+  // What was done for one pixel
+  struct Tally {
+    uint64_t rays = 0;
+    uint64_t cells = 0;
+    // Camera rays that hit something, their summed distance and normals
+    uint32_t hits = 0;
+    double depth = 0;
+    Vector3D normal;
+    // Set by a camera ray until it hits something or misses
+    bool awaitingHit = false;
+  };
+
+  AovImages(uint32_t kinds, uint32_t width, uint32_t height);
+
+  bool has(Kind kind) const { return (kinds & (1u << kind)) != 0; }
+  bool contains(uint32_t x, uint32_t y) const {
+    return x < width && y < height;
+  }
+
+  void add(uint32_t x, uint32_t y, const Tally& tally, uint64_t time);
+  void setAaDepth(uint32_t x, uint32_t y, uint32_t depth);
+
+  // Save each kind as filename with .<name>.png in place of .png
+  void save(const std::string& filename) const;
+
+ private:
+  const uint32_t kinds;
+  const uint32_t width, height;
+  std::vector<uint64_t> rays;
+  std::vector<uint64_t> times;
+  std::vector<uint32_t> aaDepths;
+  std::vector<uint64_t> cells;
+  std::vector<uint32_t> hits;
+  std::vector<double> depths;
+  std::vector<Vector3D> normals;
+};
+
+namespace aov {
+
+// What this thread is tallying for, if anything
+extern thread_local AovImages::Tally* tally;
+
+inline void countRay() {
+  if (tally) tally->rays += 1;
+}
+inline void countCameraRay() {
+  if (!tally) return;
+  tally->rays += 1;
+  tally->awaitingHit = true;
+}
+inline void countCells(uint64_t cells) {
+  if (tally) tally->cells += cells;
+}
+
+void recordFirstHit(const Ray& ray, const HitRecord* hitRecord);
+// What the ray traced for the last camera ray hit, null if nothing
+inline void firstHit(const Ray& ray, const HitRecord* hitRecord) {
+  if (tally && tally->awaitingHit) recordFirstHit(ray, hitRecord);
+}
+
+// Tallies what this thread does for pixel (x, y) for as long as it is in
+// scope. Does nothing without images, or outside them.
+class PixelScope {
+ public:
+  PixelScope(AovImages* images, uint32_t x, uint32_t y);
+  ~PixelScope();
+
+  PixelScope(const PixelScope&) = delete;
+  PixelScope& operator=(const PixelScope&) = delete;
+
+ private:
+  AovImages* const images;
+  const uint32_t x, y;
+  AovImages::Tally mine;
+  AovImages::Tally* const outer;
+  uint64_t start;
+};
+
+}
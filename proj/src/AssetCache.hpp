@@ -0,0 +1,64 @@
+#pragma once
+
+#include <sys/stat.h>
+
+#include <climits>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+
+// Things loaded from files, kept for as long as the file is unchanged, so
+// that a render server loads each texture and mesh once however many jobs
+// use it. Files are told apart by their full path, and counted as changed
+// when their modification time or size is.
+//
+// Not thread safe: scenes are loaded on one thread.
+template <typename T>
+class AssetCache {
+ public:
+  typedef std::function<std::shared_ptr<T>(const std::string&)> LoadFn;
+
+  // The asset at path, from load(path) unless an up to date one is cached.
+  // Failures (null) are not cached.
+  std::shared_ptr<T> get(const std::string& path, const LoadFn& load);
+
+  size_t size() const { return entries.size(); }
+
+ private:
+  struct Entry {
+    struct timespec modified;
+    off_t size;
+    std::shared_ptr<T> asset;
+  };
+  std::map<std::string, Entry> entries;
+};
+
+template <typename T>
+std::shared_ptr<T> AssetCache<T>::get(const std::string& path,
+                                      const LoadFn& load) {
+  char resolved[PATH_MAX];
+  struct stat info;
+  if (!realpath(path.c_str(), resolved) || stat(resolved, &info) != 0) {
+    // Let the loader say what is wrong with it
+    return load(path);
+  }
+
+  auto found = entries.find(resolved);
+  if (found != entries.end()) {
+    const auto& entry = found->second;
+    if (entry.modified.tv_sec == info.st_mtim.tv_sec &&
+        entry.modified.tv_nsec == info.st_mtim.tv_nsec &&
+        entry.size == info.st_size) {
+      return entry.asset;
+    }
+    entries.erase(found);
+  }
+
+  auto asset = load(path);
+  if (asset) {
+    entries[resolved] = {info.st_mtim, info.st_size, asset};
+  }
+  return asset;
+}
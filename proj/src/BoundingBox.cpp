@@ -0,0 +1,208 @@
+#include "BoundingBox.hpp"
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+const double INF = std::numeric_limits<double>::infinity();
+
+// Whether pts, relative to the centre of a box with the given half sizes,
+// can be separated from the box along axis
+bool separatedOn(const Vector3D& axis, const std::vector<Vector3D>& pts,
+                 const Vector3D& halfSize) {
+  // Don't bother with (near) zero axes, e.g. from parallel edges
+  if (isZero(axis.length2())) return false;
+
+  double lo = INF;
+  double hi = -INF;
+  for (const auto& pt : pts) {
+    const double d = axis.dot(pt);
+    lo = std::min(lo, d);
+    hi = std::max(hi, d);
+  }
+  const double radius = halfSize[0] * std::abs(axis[0]) +
+                        halfSize[1] * std::abs(axis[1]) +
+                        halfSize[2] * std::abs(axis[2]);
+  // Err on the side of overlapping
+  const double slack = EPSILON * (1 + radius);
+  return lo > radius + slack || hi < -radius - slack;
+}
+
+}
+
+BoundingBox::BoundingBox() : min(INF, INF, INF), max(-INF, -INF, -INF) {}
+
+BoundingBox::BoundingBox(const Point3D& min_, const Point3D& max_)
+    : min(min_), max(max_) {}
+
+BoundingBox::BoundingBox(const std::vector<Point3D>& pts) : BoundingBox() {
+  for (const auto& pt : pts) {
+    extend(pt);
+  }
+}
+
+void BoundingBox::extend(const Point3D& pt) {
+  for (int i = 0; i < 3; ++i) {
+    min[i] = std::min(min[i], pt[i]);
+    max[i] = std::max(max[i], pt[i]);
+  }
+}
+
+void BoundingBox::extend(const BoundingBox& other) {
+  if (other.isEmpty()) return;
+  extend(other.min);
+  extend(other.max);
+}
+
+void BoundingBox::pad(double amount) {
+  for (int i = 0; i < 3; ++i) {
+    min[i] -= amount;
+    max[i] += amount;
+  }
+}
+
+bool BoundingBox::isEmpty() const {
+  return min[0] > max[0] || min[1] > max[1] || min[2] > max[2];
+}
+
+Point3D BoundingBox::centre() const {
+  return Point3D((min[0] + max[0]) / 2,
+                 (min[1] + max[1]) / 2,
+                 (min[2] + max[2]) / 2);
+}
+
+Vector3D BoundingBox::size() const {
+  return max - min;
+}
+
+double BoundingBox::surfaceArea() const {
+  if (isEmpty()) return 0;
+  const auto d = size();
+  return 2 * (d[0] * d[1] + d[1] * d[2] + d[2] * d[0]);
+}
+
+int BoundingBox::longestAxis() const {
+  const auto d = size();
+  if (d[0] >= d[1] && d[0] >= d[2]) return 0;
+  return d[1] >= d[2] ? 1 : 2;
+}
+
+bool BoundingBox::overlaps(const BoundingBox& other) const {
+  for (int i = 0; i < 3; ++i) {
+    if (max[i] < other.min[i] || other.max[i] < min[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool BoundingBox::overlapsPolygon(const std::vector<Point3D>& pts) const {
+  if (pts.size() < 3) return false;
+
+  const auto c = centre();
+  const auto halfSize = size() / 2;
+  std::vector<Vector3D> rel;
+  rel.reserve(pts.size());
+  for (const auto& pt : pts) {
+    rel.push_back(pt - c);
+  }
+
+  const Vector3D boxAxes[3] = {
+    Vector3D(1, 0, 0), Vector3D(0, 1, 0), Vector3D(0, 0, 1)
+  };
+  // The box's face normals
+  for (const auto& axis : boxAxes) {
+    if (separatedOn(axis, rel, halfSize)) return false;
+  }
+
+  // The polygon's normal
+  const auto normal = (rel[1] - rel[0]).cross(rel.back() - rel[0]);
+  if (separatedOn(normal, rel, halfSize)) return false;
+
+  // Every box edge crossed with every polygon edge
+  for (size_t i = 0; i < rel.size(); ++i) {
+    const auto edge = rel[(i + 1) % rel.size()] - rel[i];
+    for (const auto& axis : boxAxes) {
+      if (separatedOn(axis.cross(edge), rel, halfSize)) return false;
+    }
+  }
+  return true;
+}
+
+bool BoundingBox::overlapsParallelepiped(
+    const std::vector<Point3D>& corners) const {
+  const auto c = centre();
+  const auto halfSize = size() / 2;
+  std::vector<Vector3D> rel;
+  rel.reserve(corners.size());
+  for (const auto& pt : corners) {
+    rel.push_back(pt - c);
+  }
+
+  // The three edge directions of the parallelepiped
+  const Vector3D edges[3] = {
+    rel[1] - rel[0], rel[3] - rel[0], rel[4] - rel[0]
+  };
+  const Vector3D boxAxes[3] = {
+    Vector3D(1, 0, 0), Vector3D(0, 1, 0), Vector3D(0, 0, 1)
+  };
+
+  for (const auto& axis : boxAxes) {
+    if (separatedOn(axis, rel, halfSize)) return false;
+  }
+  for (int i = 0; i < 3; ++i) {
+    if (separatedOn(edges[i].cross(edges[(i + 1) % 3]), rel, halfSize)) {
+      return false;
+    }
+  }
+  for (const auto& edge : edges) {
+    for (const auto& axis : boxAxes) {
+      if (separatedOn(axis.cross(edge), rel, halfSize)) return false;
+    }
+  }
+  return true;
+}
+
+double BoundingBox::distance2(const Point3D& pt) const {
+  double d2 = 0;
+  for (int i = 0; i < 3; ++i) {
+    if (pt[i] < min[i]) {
+      d2 += (min[i] - pt[i]) * (min[i] - pt[i]);
+    }
+    else if (pt[i] > max[i]) {
+      d2 += (pt[i] - max[i]) * (pt[i] - max[i]);
+    }
+  }
+  return d2;
+}
+
+bool BoundingBox::clip(const Ray& ray, const Vector3D& invDir,
+                       double* tNear, double* tFar) const {
+  // Standard slab test: intersect the range with each pair of planes
+  for (int i = 0; i < 3; ++i) {
+    if (ray.dir[i] == 0) {
+      // Parallel to these planes: either always between them or never
+      if (ray.start[i] < min[i] || ray.start[i] > max[i]) {
+        return false;
+      }
+      continue;
+    }
+    double t0 = (min[i] - ray.start[i]) * invDir[i];
+    double t1 = (max[i] - ray.start[i]) * invDir[i];
+    if (t0 > t1) std::swap(t0, t1);
+    *tNear = std::max(*tNear, t0);
+    *tFar = std::min(*tFar, t1);
+    if (*tNear > *tFar) {
+      return false;
+    }
+  }
+  return true;
+}
+
+Vector3D inverseDirection(const Vector3D& dir) {
+  return Vector3D(
+    dir[0] == 0 ? INF : 1 / dir[0],
+    dir[1] == 0 ? INF : 1 / dir[1],
+    dir[2] == 0 ? INF : 1 / dir[2]
+  );
+}
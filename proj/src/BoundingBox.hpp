@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vector>
+
+#include "algebra.hpp"
+#include "Ray.hpp"
+
+// An axis aligned box. Used by the acceleration structures.
+class BoundingBox {
+ public:
+  // An empty box: extending it by anything gives that thing's bounds
+  BoundingBox();
+  BoundingBox(const Point3D& min_, const Point3D& max_);
+  // Smallest box containing all the given points
+  explicit BoundingBox(const std::vector<Point3D>& pts);
+
+  void extend(const Point3D& pt);
+  void extend(const BoundingBox& other);
+  // Grow by amount on every side
+  void pad(double amount);
+
+  bool isEmpty() const;
+  Point3D centre() const;
+  Vector3D size() const;
+  double surfaceArea() const;
+  // Index of the longest axis
+  int longestAxis() const;
+  bool overlaps(const BoundingBox& other) const;
+  // Exact test against a flat, convex polygon (separating axis theorem)
+  bool overlapsPolygon(const std::vector<Point3D>& pts) const;
+  // Exact test against a box under any affine transformation, given its
+  // corners in the order of Cube::getBoundingBox
+  bool overlapsParallelepiped(const std::vector<Point3D>& corners) const;
+  // Squared distance from pt to the nearest point in the box
+  double distance2(const Point3D& pt) const;
+
+  // Clip the range [*tNear, *tFar] of ray to the part inside this box.
+  // invDir must hold 1 / ray.dir for each coordinate.
+  // Returns false if nothing is left.
+  bool clip(const Ray& ray, const Vector3D& invDir,
+            double* tNear, double* tFar) const;
+
+  Point3D min;
+  Point3D max;
+};
+
+// 1 / dir, for use with BoundingBox::clip
+Vector3D inverseDirection(const Vector3D& dir);
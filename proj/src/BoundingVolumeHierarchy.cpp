@@ -0,0 +1,137 @@
+#include "BoundingVolumeHierarchy.hpp"
+
+#include <algorithm>
+
+namespace {
+
+// Centroids are sorted into this many buckets along an axis, and splits are
+// only considered at bucket boundaries
+const int BIN_COUNT = 16;
+// Cost of visiting a node relative to intersecting one item
+const double TRAVERSAL_COST = 0.5;
+// Leaves larger than this are split even if SAH would rather not
+const uint32_t MAX_LEAF_SIZE = 8;
+// Keeps the traversal stack bounded
+const int MAX_DEPTH = 48;
+
+struct Bin {
+  BoundingBox bounds;
+  uint32_t count = 0;
+};
+
+int binFor(double c, double min, double extent) {
+  int b = (int) (BIN_COUNT * (c - min) / extent);
+  return std::min(std::max(b, 0), BIN_COUNT - 1);
+}
+
+} // Anonymous
+
+BoundingVolumeHierarchy::BoundingVolumeHierarchy(
+    const std::vector<BoundingBox>& bounds) {
+  if (bounds.empty()) return;
+
+  std::vector<Point3D> centres;
+  centres.reserve(bounds.size());
+  for (uint32_t i = 0; i < bounds.size(); ++i) {
+    centres.push_back(bounds[i].centre());
+    itemOrder.push_back(i);
+  }
+
+  // A complete binary tree over n leaves has 2n - 1 nodes
+  nodes.reserve(2 * bounds.size());
+  build(bounds, centres, 0, bounds.size(), 0);
+}
+
+uint32_t BoundingVolumeHierarchy::build(
+    const std::vector<BoundingBox>& bounds,
+    const std::vector<Point3D>& centres,
+    uint32_t first, uint32_t count, int depth) {
+  const uint32_t index = nodes.size();
+  nodes.emplace_back();
+
+  BoundingBox box;
+  BoundingBox centreBox;
+  for (uint32_t i = first; i < first + count; ++i) {
+    box.extend(bounds[itemOrder[i]]);
+    centreBox.extend(centres[itemOrder[i]]);
+  }
+  // Note: no references into nodes are kept, since recursing reallocates
+  nodes[index].bounds = box;
+
+  if (count <= 1 || depth >= MAX_DEPTH) {
+    makeLeaf(index, first, count);
+    return index;
+  }
+
+  // Find the cheapest split over all axes
+  const double area = box.surfaceArea();
+  double bestCost = std::numeric_limits<double>::infinity();
+  int bestAxis = -1;
+  int bestBin = 0;
+  for (int axis = 0; axis < 3; ++axis) {
+    const double min = centreBox.min[axis];
+    const double extent = centreBox.max[axis] - min;
+    if (extent <= 0) continue;
+
+    Bin bins[BIN_COUNT];
+    for (uint32_t i = first; i < first + count; ++i) {
+      auto& bin = bins[binFor(centres[itemOrder[i]][axis], min, extent)];
+      bin.bounds.extend(bounds[itemOrder[i]]);
+      bin.count += 1;
+    }
+
+    // Sweep from the right to get the cost of everything right of a split
+    double rightCost[BIN_COUNT];
+    BoundingBox right;
+    uint32_t rightCount = 0;
+    for (int b = BIN_COUNT - 1; b > 0; --b) {
+      right.extend(bins[b].bounds);
+      rightCount += bins[b].count;
+      rightCost[b] = right.surfaceArea() * rightCount;
+    }
+
+    // And then from the left, splitting after bin b
+    BoundingBox left;
+    uint32_t leftCount = 0;
+    for (int b = 0; b < BIN_COUNT - 1; ++b) {
+      left.extend(bins[b].bounds);
+      leftCount += bins[b].count;
+      if (leftCount == 0 || leftCount == count) continue;
+      double cost = TRAVERSAL_COST +
+                    (left.surfaceArea() * leftCount + rightCost[b + 1]) / area;
+      if (cost < bestCost) {
+        bestCost = cost;
+        bestAxis = axis;
+        bestBin = b;
+      }
+    }
+  }
+
+  // All centres coincide, or splitting is no better than testing everything
+  if (bestAxis < 0 || (bestCost >= count && count <= MAX_LEAF_SIZE)) {
+    makeLeaf(index, first, count);
+    return index;
+  }
+
+  const double min = centreBox.min[bestAxis];
+  const double extent = centreBox.max[bestAxis] - min;
+  auto* mid = std::partition(
+      &itemOrder[first], &itemOrder[first] + count,
+      [&] (uint32_t item) {
+        return binFor(centres[item][bestAxis], min, extent) <= bestBin;
+      });
+  const uint32_t leftCount = mid - &itemOrder[first];
+
+  build(bounds, centres, first, leftCount, depth + 1);
+  const uint32_t right =
+      build(bounds, centres, first + leftCount, count - leftCount, depth + 1);
+  nodes[index].first = right;
+  nodes[index].count = 0;
+  return index;
+}
+
+void BoundingVolumeHierarchy::makeLeaf(
+    uint32_t index, uint32_t first, uint32_t count) {
+  nodes[index].first = first;
+  nodes[index].count = count;
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "BoundingBox.hpp"
+#include "HitRecord.hpp"
+#include "Ray.hpp"
+
+// A bounding volume hierarchy built with the surface area heuristic.
+// Items are referred to by their index in the bounds given at construction,
+// so it does not care whether they are models, faces or anything else.
+class BoundingVolumeHierarchy {
+ public:
+  explicit BoundingVolumeHierarchy(const std::vector<BoundingBox>& bounds);
+
+  // Find the closest hit along ray. visit(i) must intersect item i with the
+  // ray, update hitRecord and return whether it did. Nodes are visited front
+  // to back and skipped once they are behind the closest hit so far.
+  template <typename Visitor>
+  bool intersects(const Ray& ray, HitRecord* hitRecord, Visitor visit) const;
+  // Whether any item blocks ray between tMin and tMax. visit(i) must return
+  // whether item i does. Stops at the first one that does, in no
+  // particular order.
+  template <typename Visitor>
+  bool occludes(const Ray& ray, double tMin, double tMax,
+                Visitor visit) const;
+
+  size_t nodeCount() const { return nodes.size(); }
+
+ private:
+  struct Node {
+    BoundingBox bounds;
+    // Leaves hold items [first, first + count) of itemOrder. Interior nodes
+    // have a count of 0: the left child is the next node and the right
+    // child is at index first.
+    uint32_t first = 0;
+    uint32_t count = 0;
+  };
+
+  std::vector<Node> nodes;
+  std::vector<uint32_t> itemOrder;
+
+  // Build the subtree for items [first, first + count) of itemOrder.
+  // Returns the index of its root node.
+  uint32_t build(const std::vector<BoundingBox>& bounds,
+                 const std::vector<Point3D>& centres,
+                 uint32_t first, uint32_t count, int depth);
+  void makeLeaf(uint32_t index, uint32_t first, uint32_t count);
+};
+
+template <typename Visitor>
+bool BoundingVolumeHierarchy::intersects(
+    const Ray& ray, HitRecord* hitRecord, Visitor visit) const {
+  if (nodes.empty()) return false;
+
+  const auto invDir = inverseDirection(ray.dir);
+  // Anything further than this cannot improve on the hit record
+  auto farthest = [hitRecord] () -> double {
+    return hitRecord->t >= 0 ? hitRecord->t
+                             : std::numeric_limits<double>::infinity();
+  };
+
+  // Depth of the tree is limited when building, so this is enough room
+  struct Entry {
+    uint32_t node;
+    double tNear;
+  };
+  Entry stack[64];
+  size_t top = 0;
+
+  double tNear = 0;
+  double tFar = farthest();
+  if (!nodes[0].bounds.clip(ray, invDir, &tNear, &tFar)) return false;
+  stack[top++] = {0, tNear};
+
+  bool hit = false;
+  while (top > 0) {
+    const auto entry = stack[--top];
+    if (entry.tNear > farthest()) continue;
+
+    const Node& node = nodes[entry.node];
+    if (node.count > 0) {
+      for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+        if (visit(itemOrder[i])) {
+          hit = true;
+        }
+      }
+      continue;
+    }
+
+    const uint32_t children[2] = {entry.node + 1, node.first};
+    double nears[2] = {0, 0};
+    bool hits[2];
+    for (int c = 0; c < 2; ++c) {
+      double far = farthest();
+      hits[c] = nodes[children[c]].bounds.clip(ray, invDir, &nears[c], &far);
+    }
+
+    // Push the nearer child last so that it gets visited first
+    if (hits[0] && hits[1]) {
+      const int nearer = nears[0] <= nears[1] ? 0 : 1;
+      stack[top++] = {children[1 - nearer], nears[1 - nearer]};
+      stack[top++] = {children[nearer], nears[nearer]};
+    }
+    else if (hits[0] || hits[1]) {
+      const int c = hits[0] ? 0 : 1;
+      stack[top++] = {children[c], nears[c]};
+    }
+  }
+  return hit;
+}
+
+template <typename Visitor>
+bool BoundingVolumeHierarchy::occludes(
+    const Ray& ray, double tMin, double tMax, Visitor visit) const {
+  if (nodes.empty()) return false;
+
+  const auto invDir = inverseDirection(ray.dir);
+  uint32_t stack[64];
+  size_t top = 0;
+  stack[top++] = 0;
+
+  while (top > 0) {
+    const uint32_t index = stack[--top];
+    const Node& node = nodes[index];
+    double tNear = tMin;
+    double tFar = tMax;
+    if (!node.bounds.clip(ray, invDir, &tNear, &tFar)) continue;
+
+    if (node.count > 0) {
+      for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+        if (visit(itemOrder[i])) {
+          return true;
+        }
+      }
+      continue;
+    }
+    stack[top++] = node.first;
+    stack[top++] = index + 1;
+  }
+  return false;
+}
@@ -0,0 +1,267 @@
+#include "Checkpoint.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <unordered_map>
+
+namespace {
+
+const char MAGIC[4] = {'R', 'T', 'C', 'K'};
+const uint32_t VERSION = 1;
+
+// Appends are only flushed this often, so they stay cheap
+const std::chrono::seconds FLUSH_INTERVAL(1);
+
+enum RecordKind : uint8_t {
+  TILE_RECORD = 1,
+  PIXEL_RECORD = 2,
+  SAMPLES_RECORD = 3,
+};
+
+// Records are written as they are laid out in memory, since the file is
+// only ever read back on the same machine
+template <typename T>
+void put(FILE* file, const T& value) {
+  std::fwrite(&value, sizeof(T), 1, file);
+}
+
+template <typename T>
+bool get(FILE* file, T* value) {
+  return std::fread(value, sizeof(T), 1, file) == 1;
+}
+
+// Colours are stored as floats, which is plenty for an 8 bit image
+void putColour(FILE* file, const Colour& colour) {
+  put(file, (float) colour.R());
+  put(file, (float) colour.G());
+  put(file, (float) colour.B());
+}
+
+bool getColour(FILE* file, Colour* colour) {
+  float c[3];
+  if (!get(file, &c[0]) || !get(file, &c[1]) || !get(file, &c[2])) {
+    return false;
+  }
+  *colour = Colour(c[0], c[1], c[2]);
+  return true;
+}
+
+void putTile(FILE* file, const Tile& tile,
+             const std::vector<Colour>& colours) {
+  put(file, TILE_RECORD);
+  put(file, tile);
+  for (const auto& colour : colours) {
+    putColour(file, colour);
+  }
+}
+
+void putPixel(FILE* file, uint32_t x, uint32_t y, const Colour& colour) {
+  put(file, PIXEL_RECORD);
+  put(file, x);
+  put(file, y);
+  putColour(file, colour);
+}
+
+void putSamples(FILE* file, uint32_t x, uint32_t y,
+                const SampleBuffer::Stats& stats) {
+  put(file, SAMPLES_RECORD);
+  put(file, x);
+  put(file, y);
+  put(file, stats);
+}
+
+} // Anonymous
+
+Checkpoint::Checkpoint(const std::string& path, uint64_t fingerprint_,
+                       bool resume, uint32_t width_, uint32_t height_)
+    : m_path(path), fingerprint(fingerprint_), width(width_),
+      height(height_), lastFlush(Clock::now()) {
+  if (resume) {
+    load();
+  }
+  if (!rewrite()) {
+    std::cerr << "Could not write checkpoint " << m_path
+              << ", continuing without one" << std::endl;
+  }
+}
+
+Checkpoint::~Checkpoint() {
+  if (file) {
+    std::fclose(file);
+  }
+}
+
+void Checkpoint::load() {
+  FILE* in = std::fopen(m_path.c_str(), "rb");
+  if (!in) {
+    std::cerr << "No checkpoint at " << m_path << ", starting from scratch"
+              << std::endl;
+    return;
+  }
+
+  char magic[4];
+  uint32_t version;
+  uint64_t theirs;
+  if (!get(in, &magic) || !std::equal(magic, magic + 4, MAGIC) ||
+      !get(in, &version) || version != VERSION ||
+      !get(in, &theirs) || theirs != fingerprint) {
+    std::cerr << "Checkpoint " << m_path << " is for a different render, "
+              << "starting from scratch" << std::endl;
+    std::fclose(in);
+    return;
+  }
+
+  // Later sample records for a pixel replace earlier ones
+  std::unordered_map<uint64_t, size_t> samplesIndex;
+
+  // A render that died may have left a partial record at the end. Anything
+  // unreadable, or outside the image, ends the checkpoint: what follows a
+  // damaged record cannot be trusted either.
+  auto inside = [this] (uint32_t x, uint32_t y) {
+    return x < width && y < height;
+  };
+  bool damaged = false;
+  RecordKind kind;
+  while (get(in, &kind)) {
+    if (kind == TILE_RECORD) {
+      Tile tile;
+      if (!get(in, &tile) || tile.x1 <= tile.x0 || tile.y1 <= tile.y0 ||
+          tile.x1 > width + 1 || tile.y1 > height + 1) {
+        damaged = true;
+        break;
+      }
+      const size_t count = (tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+      TileRecord record{tile, std::vector<Colour>(count, Colour(0))};
+      bool complete = true;
+      for (auto& colour : record.colours) {
+        if (!getColour(in, &colour)) {
+          complete = false;
+          break;
+        }
+      }
+      if (!complete) break;
+      loadedTiles.push_back(std::move(record));
+    }
+    else if (kind == PIXEL_RECORD) {
+      PixelRecord record{0, 0, Colour(0)};
+      if (!get(in, &record.x) || !get(in, &record.y) ||
+          !getColour(in, &record.colour)) {
+        break;
+      }
+      if (!inside(record.x, record.y)) {
+        damaged = true;
+        break;
+      }
+      loadedPixels.push_back(record);
+    }
+    else if (kind == SAMPLES_RECORD) {
+      SamplesRecord record;
+      if (!get(in, &record.x) || !get(in, &record.y) ||
+          !get(in, &record.stats)) {
+        break;
+      }
+      if (!inside(record.x, record.y)) {
+        damaged = true;
+        break;
+      }
+      const uint64_t key = ((uint64_t) record.y << 32) | record.x;
+      const auto found = samplesIndex.find(key);
+      if (found != samplesIndex.end()) {
+        loadedSamples[found->second] = record;
+      }
+      else {
+        samplesIndex[key] = loadedSamples.size();
+        loadedSamples.push_back(record);
+      }
+    }
+    else {
+      damaged = true;
+      break;
+    }
+  }
+  std::fclose(in);
+  if (damaged) {
+    std::cerr << "Checkpoint " << m_path << " is damaged, only using what "
+              << "comes before that" << std::endl;
+  }
+
+  std::cerr << "Resuming from " << m_path << ": " << loadedTiles.size()
+            << " tiles, " << loadedPixels.size() << " antialiased pixels, "
+            << loadedSamples.size() << " sampled pixels" << std::endl;
+}
+
+bool Checkpoint::rewrite() {
+  // Written beside the old one and moved over it, so that dying part way
+  // through does not lose what the old one had
+  const std::string temp = m_path + ".tmp";
+  FILE* out = std::fopen(temp.c_str(), "wb");
+  if (!out) return false;
+
+  std::fwrite(MAGIC, 1, sizeof(MAGIC), out);
+  put(out, VERSION);
+  put(out, fingerprint);
+  for (const auto& record : loadedTiles) {
+    putTile(out, record.tile, record.colours);
+  }
+  for (const auto& record : loadedPixels) {
+    putPixel(out, record.x, record.y, record.colour);
+  }
+  for (const auto& record : loadedSamples) {
+    putSamples(out, record.x, record.y, record.stats);
+  }
+  if (std::fclose(out) != 0 || std::rename(temp.c_str(), m_path.c_str())) {
+    return false;
+  }
+
+  file = std::fopen(m_path.c_str(), "ab");
+  return file != nullptr;
+}
+
+void Checkpoint::addTile(const Tile& tile,
+                         const std::vector<Colour>& colours) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (!file) return;
+  putTile(file, tile, colours);
+  appended();
+}
+
+void Checkpoint::addPixels(std::vector<PixelRecord>* records) {
+  if (records->empty()) return;
+  std::lock_guard<std::mutex> lock(mutex);
+  if (file) {
+    for (const auto& record : *records) {
+      putPixel(file, record.x, record.y, record.colour);
+    }
+    appended();
+  }
+  records->clear();
+}
+
+void Checkpoint::addSamples(std::vector<SamplesRecord>* records) {
+  if (records->empty()) return;
+  std::lock_guard<std::mutex> lock(mutex);
+  if (file) {
+    for (const auto& record : *records) {
+      putSamples(file, record.x, record.y, record.stats);
+    }
+    appended();
+  }
+  records->clear();
+}
+
+void Checkpoint::appended() {
+  const auto now = Clock::now();
+  if (now - lastFlush >= FLUSH_INTERVAL) {
+    std::fflush(file);
+    lastFlush = now;
+  }
+}
+
+void Checkpoint::remove() {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (file) {
+    std::fclose(file);
+    file = nullptr;
+  }
+  std::remove(m_path.c_str());
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "algebra.hpp"
+#include "SampleBuffer.hpp"
+#include "TileScheduler.hpp"
+
+// The work a render has finished, appended to a file as it goes. If the
+// render dies, the next one can load it and only do what is left.
+class Checkpoint {
+ public:
+  struct TileRecord {
+    Tile tile;
+    // Row by row
+    std::vector<Colour> colours;
+  };
+  struct PixelRecord {
+    uint32_t x, y;
+    Colour colour;
+  };
+  struct SamplesRecord {
+    uint32_t x, y;
+    SampleBuffer::Stats stats;
+  };
+
+  // Start a checkpoint at path, for an image of width x height. Tiles may
+  // cover one more row and column, as the traced corners do. fingerprint
+  // identifies what is being rendered. If resume is set and path holds a
+  // checkpoint with the same fingerprint, its records are loaded and kept,
+  // up to the first that does not fit the image.
+  Checkpoint(const std::string& path, uint64_t fingerprint, bool resume,
+             uint32_t width, uint32_t height);
+  ~Checkpoint();
+
+  // Pixels worth of records a thread should gather before handing them
+  // over, so that it takes the lock once per batch rather than per pixel
+  static const size_t BATCH_SIZE = 1024;
+
+  // Record finished work. Safe to call from any thread. Batches of records
+  // are written in one go, and emptied.
+  void addTile(const Tile& tile, const std::vector<Colour>& colours);
+  void addPixels(std::vector<PixelRecord>* records);
+  // Only the latest record for each pixel counts
+  void addSamples(std::vector<SamplesRecord>* records);
+
+  // What was loaded when resuming
+  const std::vector<TileRecord>& tiles() const { return loadedTiles; }
+  const std::vector<PixelRecord>& pixels() const { return loadedPixels; }
+  const std::vector<SamplesRecord>& samples() const { return loadedSamples; }
+
+  // The render finished, so there is nothing to resume: delete the file
+  void remove();
+
+  const std::string& path() const { return m_path; }
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  const std::string m_path;
+  const uint64_t fingerprint;
+  const uint32_t width, height;
+
+  std::mutex mutex;
+  FILE* file = nullptr;
+  Clock::time_point lastFlush;
+
+  std::vector<TileRecord> loadedTiles;
+  std::vector<PixelRecord> loadedPixels;
+  std::vector<SamplesRecord> loadedSamples;
+
+  // Read the records at path, if it is a checkpoint for this render
+  void load();
+  // Start the file over, with just the header and what was loaded, and
+  // open it for appending
+  bool rewrite();
+  // Push records out to the file every so often. Call with mutex held.
+  void appended();
+};
@@ -1,5 +1,7 @@
 #include "HitRecord.hpp"
 
+#include "RenderCounters.hpp"
+
 bool HitRecord::update(const Vector3D& n, const Point3D& pt, double newT,
                        double xp, double yp) {
   if (newT < 0 || (t >= 0 && newT >= t)) {
@@ -10,5 +12,6 @@ bool HitRecord::update(const Vector3D& n, const Point3D& pt, double newT,
   point = pt;
   xPercent = xp;
   yPercent = yp;
+  counters::countHitUpdate();
   return true;
 }
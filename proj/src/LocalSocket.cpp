@@ -0,0 +1,80 @@
+#include "LocalSocket.hpp"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+bool socketAddress(const std::string& path, sockaddr_un* address) {
+  std::memset(address, 0, sizeof(*address));
+  address->sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address->sun_path)) {
+    std::cerr << "Socket path too long: " << path << std::endl;
+    return false;
+  }
+  std::strcpy(address->sun_path, path.c_str());
+  return true;
+}
+
+} // Anonymous
+
+int listenAt(const std::string& path) {
+  sockaddr_un address;
+  if (!socketAddress(path, &address)) return -1;
+
+  // Left over from a process that died
+  unlink(path.c_str());
+
+  const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0 ||
+      bind(listener, (sockaddr*) &address, sizeof(address)) < 0 ||
+      listen(listener, 16) < 0) {
+    std::cerr << "Could not listen at " << path << ": "
+              << std::strerror(errno) << std::endl;
+    if (listener >= 0) close(listener);
+    return -1;
+  }
+  return listener;
+}
+
+int connectTo(const std::string& path) {
+  sockaddr_un address;
+  if (!socketAddress(path, &address)) return -1;
+
+  const int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (connection < 0 ||
+      connect(connection, (sockaddr*) &address, sizeof(address)) < 0) {
+    std::cerr << "Could not connect to " << path << ": "
+              << std::strerror(errno) << std::endl;
+    if (connection >= 0) close(connection);
+    return -1;
+  }
+  return connection;
+}
+
+bool sendAll(int socket, const void* data, size_t size) {
+  const char* bytes = static_cast<const char*>(data);
+  while (size > 0) {
+    const ssize_t sent = send(socket, bytes, size, MSG_NOSIGNAL);
+    if (sent <= 0) return false;
+    bytes += sent;
+    size -= sent;
+  }
+  return true;
+}
+
+bool receiveAll(int socket, void* data, size_t size) {
+  char* bytes = static_cast<char*>(data);
+  while (size > 0) {
+    const ssize_t got = recv(socket, bytes, size, 0);
+    if (got <= 0) return false;
+    bytes += got;
+    size -= got;
+  }
+  return true;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Helpers for the Unix domain sockets that rt processes talk to each other
+// over. Failures are reported on stderr.
+
+// Listen at path, replacing any socket a dead process left there. Returns
+// the socket, or -1.
+int listenAt(const std::string& path);
+// Returns the socket, or -1 if nothing is listening at path
+int connectTo(const std::string& path);
+
+// Send or receive exactly size bytes. False if the other end went away.
+// Sending never raises SIGPIPE.
+bool sendAll(int socket, const void* data, size_t size);
+bool receiveAll(int socket, void* data, size_t size);
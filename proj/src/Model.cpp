@@ -1,11 +1,28 @@
 #include "Model.hpp"
 
 #include "HitRecord.hpp"
+#include "primitives/Mesh.hpp"
+
+namespace {
+
+// Primitives only look for hits after the start of the ray, so move the
+// start up to tMin. t keeps its scale, just offset by tMin.
+Ray startingAt(const Ray& ray, double tMin) {
+  const auto start = ray.at(tMin);
+  return Ray(start, start + ray.dir);
+}
+
+}
 
 Model::Model(Primitive* primitive_,
              Material* material_,
              const Matrix4x4& xform_)
-  : primitive(primitive_), material(material_), xform(xform_) { }
+  : primitive(primitive_), material(material_), xform(xform_),
+    mesh(dynamic_cast<const Mesh*>(primitive_)) {
+  if (mesh) {
+    toWorld = xform.invert();
+  }
+}
 
 bool Model::intersects(const Ray& ray, HitRecord* hitRecord) const {
   if (primitive->intersects(ray, hitRecord, xform)) {
@@ -15,6 +32,47 @@ bool Model::intersects(const Ray& ray, HitRecord* hitRecord) const {
   return false;
 }
 
+bool Model::occludes(const Ray& ray, double tMin, double tMax) const {
+  if (tMin > 0) {
+    return primitive->occludes(startingAt(ray, tMin), tMax - tMin, xform);
+  }
+  return primitive->occludes(ray, tMax, xform);
+}
+
 std::vector<Point3D> Model::getBoundingBox() const {
   return primitive->getBoundingBox(xform);
 }
+
+BoundingBox Model::getBounds() const {
+  return BoundingBox(getBoundingBox());
+}
+
+bool Model::overlaps(const BoundingBox& box) const {
+  return primitive->overlapsBox(box, xform);
+}
+
+size_t Model::faceCount() const {
+  return mesh ? mesh->faceCount() : 0;
+}
+
+bool Model::intersectsFace(size_t face,
+                           const Ray& ray, HitRecord* hitRecord) const {
+  if (mesh->intersectsFace(face, ray, hitRecord, xform)) {
+    hitRecord->material = material;
+    return true;
+  }
+  return false;
+}
+
+bool Model::occludesFace(size_t face,
+                         const Ray& ray, double tMin, double tMax) const {
+  if (tMin > 0) {
+    return mesh->occludesFace(
+        face, startingAt(ray, tMin), tMax - tMin, xform);
+  }
+  return mesh->occludesFace(face, ray, tMax, xform);
+}
+
+std::vector<Point3D> Model::getFaceVertices(size_t face) const {
+  return mesh->getFaceVertices(face, toWorld);
+}
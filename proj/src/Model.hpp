@@ -3,11 +3,13 @@
 #include <vector>
 
 #include "algebra.hpp"
+#include "BoundingBox.hpp"
 #include "materials/Material.hpp"
 #include "Ray.hpp"
 #include "primitives/Primitive.hpp"
 
 class HitRecord;
+class Mesh;
 
 class Model {
  public:
@@ -16,11 +18,34 @@ class Model {
         const Matrix4x4& xform_);
 
   bool intersects(const Ray& ray, HitRecord* hitRecord) const;
+  // Whether the model blocks ray anywhere with tMin < t < tMax
+  bool occludes(const Ray& ray, double tMin, double tMax) const;
 
   std::vector<Point3D> getBoundingBox() const;
+  // Axis aligned box around getBoundingBox
+  BoundingBox getBounds() const;
+  // Whether the model might lie in box. Never false when it does.
+  bool overlaps(const BoundingBox& box) const;
+  const Material* getMaterial() const { return material; }
+
+  // Meshes can be split into their faces. The number of faces, or 0 if this
+  // model cannot be split.
+  size_t faceCount() const;
+  bool intersectsFace(size_t face,
+                      const Ray& ray, HitRecord* hitRecord) const;
+  bool occludesFace(size_t face,
+                    const Ray& ray, double tMin, double tMax) const;
+  // World coordinates of the face's vertices
+  std::vector<Point3D> getFaceVertices(size_t face) const;
 
  private:
   const Primitive* primitive;
   const Material* material;
+  // Note: this is the inverse transformation, taking world to model
   const Matrix4x4 xform;
+
+  // Set if primitive is a mesh
+  const Mesh* mesh;
+  // Model to world, only needed for meshes
+  Matrix4x4 toWorld;
 };
@@ -0,0 +1,80 @@
+#include "ObjLoader.hpp"
+
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "AssetCache.hpp"
+
+namespace {
+
+std::shared_ptr<Mesh> readObj(const std::string& filename) {
+  std::ifstream file(filename);
+  if (!file) {
+    std::cerr << "Error opening " << filename << std::endl;
+    return nullptr;
+  }
+
+  std::vector<Point3D> verts;
+  std::vector<Vector3D> normals;
+  std::vector<std::vector<std::vector<int>>> faces;
+
+  std::string line;
+  while (std::getline(file, line)) {
+    std::istringstream in(line);
+    std::string command;
+    in >> command;
+
+    if (command == "v" || command == "vn") {
+      double a = 0, b = 0, c = 0;
+      in >> a >> b >> c;
+      if (command == "v") {
+        verts.emplace_back(a, b, c);
+      }
+      else {
+        normals.emplace_back(a, b, c);
+      }
+    }
+    else if (command == "f") {
+      // Each vertex is a run of indices split by slashes, like 3/1/2 or
+      // 3//2. Every index there is kept, counting from zero.
+      std::vector<std::vector<int>> face;
+      std::string vertex;
+      while (in >> vertex) {
+        std::vector<int> indices;
+        int index = -1;
+        for (const char c : vertex) {
+          if (std::isdigit(c)) {
+            index = (index < 0 ? 0 : index * 10) + (c - '0');
+          }
+          else if (index >= 0) {
+            indices.push_back(index - 1);
+            index = -1;
+          }
+        }
+        if (index >= 0) {
+          indices.push_back(index - 1);
+        }
+        if (!indices.empty()) {
+          face.push_back(indices);
+        }
+      }
+      faces.push_back(face);
+    }
+  }
+
+  if (verts.empty() || faces.empty()) {
+    std::cerr << "No mesh in " << filename << std::endl;
+    return nullptr;
+  }
+  return std::make_shared<Mesh>(std::move(verts), std::move(normals), faces);
+}
+
+} // Anonymous
+
+std::shared_ptr<Mesh> loadObj(const std::string& filename) {
+  static AssetCache<Mesh> cache;
+  return cache.get(filename, readObj);
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "primitives/Mesh.hpp"
+
+// The mesh in an OBJ file, read the way data/readobj.lua reads it: just
+// vertices, vertex normals and faces. Meshes are cached, so each file is
+// only read again once it changes. Null if the file cannot be read.
+std::shared_ptr<Mesh> loadObj(const std::string& filename);
@@ -1,18 +1,37 @@
 #include "RayTracer.hpp"
 
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
 #include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
 #include <cmath>
+#include <csignal>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
 #include <iomanip>
+#include <random>
 #include <thread>
+#include <unordered_set>
 
 #include "Antialiaser.hpp"
+#include "AovImages.hpp"
 #include "image.hpp"
 #include "scene.hpp"
 #include "HitRecord.hpp"
 #include "PixelTransformer.hpp"
 #include "primitives/Mesh.hpp"
 #include "Ray.hpp"
+#include "RenderCounters.hpp"
+#include "SnapshotWriter.hpp"
+#include "TileCoordinator.hpp"
+#include "TraceRecorder.hpp"
 #include "ViewConfig.hpp"
 #include "xform.hpp"
 
@@ -21,6 +40,25 @@ const std::string ESC = "\x1b";
 const std::string UP_ONE = ESC + "[1A";
 const std::string ERASE_LINE = ESC + "[2K";
 
+// Width and height of the tiles handed to threads, in pixels
+const uint32_t TILE_SIZE = 16;
+
+// Adaptive sampling starts every pixel with this many samples, and never
+// gives one more than the maximum
+const uint32_t MIN_PIXEL_SAMPLES = 4;
+const uint32_t MAX_PIXEL_SAMPLES = 1024;
+
+// Progressive renders first sample one pixel in blocks of this size, then
+// halve it until every pixel has a sample
+const uint32_t COARSEST_BLOCK = 8;
+
+// Tiles handed to worker processes are bigger, since each is a round trip
+const uint32_t DISTRIBUTED_TILE_SIZE = 64;
+
+// Antialiasing refines pixels in bands of this many rows, top to bottom,
+// forgetting the sub-samples above each band once it is done
+const uint32_t ANTIALIAS_BAND_ROWS = 8;
+
 double colourSize(const Colour& c) {
   return std::sqrt(c.R()*c.R() + c.B()*c.B() + c.G()*c.G());
 }
@@ -29,6 +67,78 @@ bool vectorZero(const Vector3D& v) {
   return isZero(v[0]) && isZero(v[1]) && isZero(v[2]);
 }
 
+// The part of a width x height image that crop covers, or all of it if
+// crop is empty. A crop that is not wholly inside the image is an error,
+// which leaves nothing to render.
+Tile cropWindow(uint32_t width, uint32_t height, const Tile& crop) {
+  if (crop.x0 >= crop.x1 || crop.y0 >= crop.y1) {
+    return {0, 0, width, height};
+  }
+  if (crop.x1 > width || crop.y1 > height) {
+    std::cerr << "Crop of " << crop.x1 - crop.x0 << "x" << crop.y1 - crop.y0
+              << " at (" << crop.x0 << ", " << crop.y0 << ") is not inside "
+              << "the " << width << "x" << height << " image" << std::endl;
+    return {0, 0, 0, 0};
+  }
+  return crop;
+}
+
+// The last BVH built, and the bounds it was built over. Renders in one
+// process, such as jobs sent to a render server, often have the same
+// models again.
+struct {
+  std::vector<BoundingBox> bounds;
+  std::shared_ptr<const BoundingVolumeHierarchy> bvh;
+} lastBvh;
+
+bool sameBounds(const std::vector<BoundingBox>& a,
+                const std::vector<BoundingBox>& b) {
+  if (a.size() != b.size()) return false;
+  for (size_t i = 0; i < a.size(); ++i) {
+    for (int j = 0; j < 3; ++j) {
+      if (a[i].min[j] != b[i].min[j] || a[i].max[j] != b[i].max[j]) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Add the seconds since start to *total, if there is one
+void addTime(double* total, std::chrono::steady_clock::time_point start) {
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  *total += elapsed.count();
+}
+
+// FNV-1a, to fingerprint renders with
+template <typename T>
+void hashInto(uint64_t* hash, const T& value) {
+  const auto* bytes = reinterpret_cast<const unsigned char*>(&value);
+  for (size_t i = 0; i < sizeof(T); ++i) {
+    *hash = (*hash ^ bytes[i]) * 1099511628211ull;
+  }
+}
+
+// Fill image from colourAt(x, y, &count), the mean and sample count of each
+// pixel. Pixels with no samples take the colour of the top left pixel of
+// their block, which has one unless the first pass was cut short.
+template <typename ColourAt>
+void fillImage(Image* image, uint32_t block, ColourAt colourAt) {
+  for (int y = 0; y < image->height(); ++y) {
+    for (int x = 0; x < image->width(); ++x) {
+      uint32_t count;
+      auto colour = colourAt(x, y, &count);
+      if (count == 0) {
+        colour = colourAt(x - x % block, y - y % block, &count);
+      }
+      (*image)(x, y, 0) = colour.R();
+      (*image)(x, y, 1) = colour.G();
+      (*image)(x, y, 2) = colour.B();
+    }
+  }
+}
+
 } // Anonymous
 
 RayTracer::RayTracer(SceneNode* root,
@@ -37,36 +147,89 @@ RayTracer::RayTracer(SceneNode* root,
                      Colour ambient_,
                      std::list<Light*> lights_,
                      const RayTracer::Options& options_) :
-    imageWidth(width_), imageHeight(height_),
+    fullWidth(width_), fullHeight(height_),
+    window(cropWindow(width_, height_, options_.crop)),
+    imageWidth(window.x1 - window.x0), imageHeight(window.y1 - window.y0),
     viewConfig(std::move(viewConfig_)),
     ambientColour(std::move(ambient_)),
     lights(std::move(lights_)),
-    tempImage(width_ + 1, height_ + 1, 3),
-    finalImage(width_, height_, 3),
+    tempImage(imageWidth + 1, imageHeight + 1, 3),
+    finalImage(imageWidth, imageHeight, 3),
     options(options_),
+    budget(options_.timeLimit, options_.rayLimit, options_.cancelled,
+           options_.stats != nullptr),
     pixelTransformer(rayWidth(), rayHeight(), viewConfig_)
 { // Stop indenting, damnit
 
   // This is such a horrible hack
   Mesh::interpolateNormals = options_.phongInterpolation;
 
-  // Initialize image data to black
-  for (uint32_t y = 0; y < imageHeight + 1; ++y) {
-    for (uint32_t x = 0; x < imageWidth + 1; ++x) {
-      for (auto i = 0; i < 3; ++i)
-        tempImage(x, y, i) = 0;
-    }
+  if (options.aaDepth > 0 && options.noiseTarget <= 0) {
+    pixelCosts.resize((imageWidth + 1) * (imageHeight + 1), 0);
   }
 
+  sceneRoot = root;
+  threadPercents.resize(options.threadCount + 1);
+  if (imageWidth == 0 || imageHeight == 0) {
+    // A bad crop: there is nothing to build the scene for, and render fails
+    return;
+  }
+  if (imageWidth < fullWidth || imageHeight < fullHeight) {
+    std::cerr << "Rendering " << imageWidth << "x" << imageHeight << " at ("
+              << window.x0 << ", " << window.y0 << ") of " << fullWidth
+              << "x" << fullHeight << std::endl;
+  }
+  buildScene();
+}
+
+void RayTracer::setView(const ViewConfig& viewConfig_) {
+  viewConfig = viewConfig_;
+  pixelTransformer = PixelTransformer(rayWidth(), rayHeight(), viewConfig);
+  if (culled) {
+    buildScene();
+  }
+
+  // Nothing of the last frame may show through where this one stops early
+  setWindow(window);
+  budget.restart();
+}
+
+void RayTracer::buildScene() {
+  models.clear();
+  bvhModels.clear();
+  bvh = nullptr;
+  uniformGrid = nullptr;
+
+  auto start = std::chrono::steady_clock::now();
   minPoint = Point3D(1e20, 1e20, 1e20);
   maxPoint = Point3D(-1e20, -1e20, -1e20);
-  extractModels(root);
+  extractModels(sceneRoot);
+  if (imageWidth < fullWidth || imageHeight < fullHeight) {
+    cullModels();
+  }
+  if (options.stats) {
+    addTime(&options.stats->extraction, start);
+  }
+  trace::record("Extract models", start);
+  start = std::chrono::steady_clock::now();
 
-  if (options.uniformGrid) {
+  if (options.boundingVolumeHierarchy) {
+    buildBvh();
+    trace::record("Build BVH", start);
+  }
+  else if (options.uniformGrid) {
+    // Unlike the BVH, this is built afresh for every render. Which cells a
+    // model lands in depends on its shape and not just its bounds, so two
+    // scenes with the same bounds can need different grids, and the grid
+    // points at this render's models.
     uniformGrid = std::make_unique<UniformGrid>(
-        models, minPoint, maxPoint, options.uniformGridSizeFactor);
+        models, minPoint, maxPoint, options.uniformGridSizeFactor,
+        options.splitMeshes, options.uniformGridLevels, options.threadCount);
+    trace::record("Build grid", start);
+  }
+  if (options.stats) {
+    addTime(&options.stats->accelBuild, start);
   }
-  threadPercents.resize(options.threadCount + 1);
 }
 
 Colour RayTracer::rayColour(const Ray& ray, double x, double y,
@@ -79,9 +242,11 @@ Colour RayTracer::rayColour(const Ray& ray, double x, double y,
 
   HitRecord hitRecord;
   if (!getIntersection(ray, &hitRecord)) {
+    aov::firstHit(ray, nullptr);
     // No intersection - use background colour
     return backgroundColour(x, y);
   }
+  aov::firstHit(ray, &hitRecord);
 
   Colour colour(0, 0, 0);
 
@@ -104,9 +269,11 @@ Colour RayTracer::rayColour(const Ray& ray, double x, double y,
   for (const auto light : lights) {
     const auto lightPoints = light->getPoints(options.shadowSamples);
     for (const auto& lightPoint : lightPoints) {
+      // The light is at t = 1
       Ray shadowRay(hitRecord.point, lightPoint);
-      HitRecord r;
-      if (!(getIntersection(shadowRay, &r) && r.t < 1)) {
+      counters::countRay(RenderCounters::SHADOW_RAY);
+      aov::countRay();
+      if (!isOccluded(shadowRay, 0, 1)) {
         // Only add from light source if nothing is hit first
         auto litColour = material->lightColour(
             materialColour, direction, lightPoint, *light, hitRecord);
@@ -123,6 +290,10 @@ Colour RayTracer::rayColour(const Ray& ray, double x, double y,
     for (const auto& reflDir : reflectedRays) {
       if (vectorZero(reflDir)) continue;
       Ray reflectedRay(hitRecord.point, hitRecord.point + reflDir);
+      counters::countRay(reflectedRays.size() > 1
+                         ? RenderCounters::GLOSSY_RAY
+                         : RenderCounters::REFLECTED_RAY);
+      aov::countRay();
       auto col = rayColour(reflectedRay, x, y, depth + 1,
                            rc, refractionIndex);
       reflectedColour = reflectedColour + (col / reflectedRays.size());
@@ -143,6 +314,8 @@ Colour RayTracer::rayColour(const Ray& ray, double x, double y,
     if (!vectorZero(refrDir)) {
 
       Ray transRay(hitRecord.point, hitRecord.point + refrDir);
+      counters::countRay(RenderCounters::REFRACTED_RAY);
+      aov::countRay();
       // Multiply by proportion that is transmitted
       auto transRayColour = (1 - alpha) * rc;
       // TODO: Use proper index based on whether or not we are now inside
@@ -190,70 +363,893 @@ void RayTracer::extractModels(SceneNode* root, const Matrix4x4& inverse) {
   }
 }
 
-void RayTracer::writePixel(uint32_t x, uint32_t y, const Colour& colour) {
-  auto xPx = x / options.sampleRateX;
-  auto yPx = y / options.sampleRateY;
+void RayTracer::cullModels() {
+  // Reflected and refracted rays can go anywhere, and then so can shadow
+  // rays from where they land. Refracted rays do not count towards the
+  // depth limit, but reflected ones are never traced with a limit of 1.
+  for (const auto& model : models) {
+    const auto* material = model.getMaterial();
+    if (material->isTransparent() ||
+        (material->isSpecular() && options.recursiveDepthLimit > 1)) {
+      std::cerr << "Not culling models: some reflect or refract" << std::endl;
+      return;
+    }
+  }
+
+  // Otherwise everything seen lies in the window's frustum, inside the
+  // scene. Find a box around that: cut the frustum off past the farthest
+  // corner of the scene, and then keep the part in the scene's box.
+  auto w = viewConfig.view;
+  w.normalize();
+  double farthest = 0;
+  for (int i = 0; i < 8; ++i) {
+    const Point3D corner(i & 1 ? maxPoint[0] : minPoint[0],
+                         i & 2 ? maxPoint[1] : minPoint[1],
+                         i & 4 ? maxPoint[2] : minPoint[2]);
+    farthest = std::max(farthest, (corner - viewConfig.eye).dot(w));
+  }
+
+  // The window's rays, with a ray's width to spare. The extra row and column
+  // of tempImage are included. y is flipped as in pixelColour.
+  const auto sx = options.sampleRateX;
+  const auto sy = options.sampleRateY;
+  const double xs[2] = {window.x0 * sx - 1.0, (window.x1 + 1.0) * sx + 1};
+  const double ys[2] = {window.y0 * sy - 1.0, (window.y1 + 1.0) * sy + 1};
+  BoundingBox seen;
+  seen.extend(viewConfig.eye);
+  for (double x : xs) {
+    for (double y : ys) {
+      const auto dir =
+          pixelTransformer.transform(x, rayHeight() - 1 - y) - viewConfig.eye;
+      seen.extend(viewConfig.eye + (farthest / dir.dot(w)) * dir);
+    }
+  }
+  for (int i = 0; i < 3; ++i) {
+    seen.min[i] = std::max(seen.min[i], minPoint[i]);
+    seen.max[i] = std::min(seen.max[i], maxPoint[i]);
+  }
+
+  // Shadow rays run from what is seen to the lights, so stay in a box
+  // around both
+  BoundingBox region = seen;
+  for (const auto* light : lights) {
+    region.extend(light->getBounds());
+  }
+  region.pad(EPSILON);
+
+  const size_t before = models.size();
+  models.remove_if([&] (const Model& model) {
+    return !region.overlaps(model.getBounds());
+  });
+  culled = true;
+
+  // The acceleration structures only need to cover what is left
+  minPoint = Point3D(1e20, 1e20, 1e20);
+  maxPoint = Point3D(-1e20, -1e20, -1e20);
+  for (const auto& model : models) {
+    const auto box = model.getBounds();
+    extremize(&minPoint, box.min,
+              [] (double a, double b) { return std::min(a,b); });
+    extremize(&maxPoint, box.max,
+              [] (double a, double b) { return std::max(a,b); });
+  }
+  std::cerr << "Culled " << before - models.size() << " of " << before
+            << " models outside the crop" << std::endl;
+}
+
+void RayTracer::buildBvh() {
+  auto start = std::chrono::steady_clock::now();
+
+  std::vector<BoundingBox> bounds;
+  for (const auto& model : models) {
+    bvhModels.push_back(&model);
+    auto box = model.getBounds();
+    // Leave a little room so flat models are not missed by grazing rays
+    box.pad(EPSILON);
+    bounds.push_back(box);
+  }
+  const bool reused = lastBvh.bvh && sameBounds(bounds, lastBvh.bounds);
+  if (reused) {
+    bvh = lastBvh.bvh;
+  }
+  else {
+    bvh = std::make_shared<BoundingVolumeHierarchy>(bounds);
+    lastBvh.bounds = std::move(bounds);
+    lastBvh.bvh = bvh;
+  }
+
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::cerr << (reused ? "BVH reused in " : "BVH build time: ")
+            << elapsed.count() << " ms, "
+            << bvh->nodeCount() << " nodes for "
+            << bvhModels.size() << " models" << std::endl;
+}
+
+uint64_t RayTracer::fingerprint(bool sampling) const {
+  uint64_t hash = 14695981039346656037ull;
+  hashInto(&hash, fullWidth);
+  hashInto(&hash, fullHeight);
+  hashInto(&hash, window);
+  hashInto(&hash, sampling);
+  hashInto(&hash, options.sampleRateX);
+  hashInto(&hash, options.sampleRateY);
+  hashInto(&hash, options.phongInterpolation);
+  hashInto(&hash, options.aaTolerance);
+  hashInto(&hash, options.aaDepth);
+  hashInto(&hash, options.noiseTarget);
+  hashInto(&hash, options.sampleBudget);
+  hashInto(&hash, options.shadowSamples);
+  hashInto(&hash, options.recursiveDepthLimit);
+  hashInto(&hash, options.glossyReflection);
+
+  // What the scene looks like from here. Lights are hashed by what the
+  // render uses of them: the points shadows are cast to, colour, and
+  // falloff, which three distances pin down.
+  hashInto(&hash, viewConfig.eye);
+  hashInto(&hash, viewConfig.view);
+  hashInto(&hash, viewConfig.up);
+  hashInto(&hash, viewConfig.fov);
+  hashInto(&hash, ambientColour);
+  for (const auto light : lights) {
+    for (const auto& point : light->getPoints(options.shadowSamples)) {
+      hashInto(&hash, point);
+    }
+    hashInto(&hash, light->getColour());
+    for (int distance = 0; distance < 3; ++distance) {
+      hashInto(&hash, light->getFalloff(distance));
+    }
+  }
+
+  // Anything else about the scene could have changed with its file
+  for (const auto c : options.sceneFile) {
+    hashInto(&hash, c);
+  }
+  struct stat info;
+  if (!options.sceneFile.empty() &&
+      stat(options.sceneFile.c_str(), &info) == 0) {
+    hashInto(&hash, info.st_mtim);
+    hashInto(&hash, info.st_size);
+  }
+  return hash;
+}
+
+uint32_t RayTracer::defaultThreadCount() {
+  // hardware_concurrency may not know, in which case it gives 0
+  const auto cores = std::thread::hardware_concurrency();
+  return cores > 0 ? cores : 4;
+}
+
+void RayTracer::antialias() {
+  Antialiaser antialiaser(this, &tempImage,
+                          options.aaTolerance, options.aaDepth);
+  auto setPixel = [this] (uint32_t x, uint32_t y, const Colour& colour) {
+    finalImage(x, y, 0) = colour.R();
+    finalImage(x, y, 1) = colour.G();
+    finalImage(x, y, 2) = colour.B();
+  };
+
+  // Pixels that need refining become work items. The rest just take the
+  // colour already traced at their corner.
+  struct Item {
+    uint32_t x, y;
+    // Guessed before, then measured, in microseconds
+    double cost;
+  };
+  std::vector<Item> items;
+
+  // Pixels an earlier run already refined
+  std::vector<bool> refined(imageWidth * imageHeight, false);
+  if (checkpoint) {
+    for (const auto& record : checkpoint->pixels()) {
+      setPixel(record.x, record.y, record.colour);
+      refined[record.y * imageWidth + record.x] = true;
+    }
+  }
+
+  for (uint32_t y = 0; y < imageHeight; ++y) {
+    for (uint32_t x = 0; x < imageWidth; ++x) {
+      if (refined[y * imageWidth + x]) continue;
+      if (!antialiaser.needsRefinement(x, y)) {
+        setPixel(x, y, antialiaser.antialias(x, y));
+        continue;
+      }
+      // Refining traces rays all over the pixel, so guess that they cost
+      // about what the rays at its corners did
+      const auto w = imageWidth + 1;
+      const double cost = pixelCosts[y * w + x] + pixelCosts[y * w + x + 1] +
+                          pixelCosts[(y + 1) * w + x] +
+                          pixelCosts[(y + 1) * w + x + 1];
+      items.push_back({x, y, cost});
+      // In case the render is stopped before getting to it
+      setPixel(x, y, antialiaser.unrefined(x, y));
+    }
+  }
+  if (items.empty()) return;
+
+  // Hand out the bands in order, and the most expensive pixels of each
+  // first, one at a time, so that the cheap ones can even out the threads
+  // at the end. Nothing waits for a band to finish: threads go on to the
+  // next while the last pixels of one are still going.
+  std::sort(items.begin(), items.end(), [] (const Item& a, const Item& b) {
+    const auto bandA = a.y / ANTIALIAS_BAND_ROWS;
+    const auto bandB = b.y / ANTIALIAS_BAND_ROWS;
+    return bandA != bandB ? bandA < bandB : a.cost > b.cost;
+  });
+  const size_t bandCount =
+      (imageHeight + ANTIALIAS_BAND_ROWS - 1) / ANTIALIAS_BAND_ROWS;
+  std::unique_ptr<std::atomic<size_t>[]> bandLeft(
+      new std::atomic<size_t>[bandCount]);
+  for (size_t band = 0; band < bandCount; ++band) {
+    bandLeft[band] = 0;
+  }
+  for (const auto& item : items) {
+    bandLeft[item.y / ANTIALIAS_BAND_ROWS] += 1;
+  }
+  // Bands above this are all done, so the sub-samples above it are no
+  // use to anyone
+  std::mutex bandMutex;
+  size_t firstUnfinished = 0;
+  auto finishedBands = [&] {
+    std::lock_guard<std::mutex> lock(bandMutex);
+    const auto before = firstUnfinished;
+    while (firstUnfinished < bandCount && bandLeft[firstUnfinished] == 0) {
+      firstUnfinished += 1;
+    }
+    if (firstUnfinished > before) {
+      antialiaser.forgetAbove(std::min<size_t>(
+          firstUnfinished * ANTIALIAS_BAND_ROWS, imageHeight));
+    }
+  };
+
+  std::vector<double> busy(options.threadCount, 0);
+  std::vector<Antialiaser::CacheCounts> cacheCounts(options.threadCount);
+  // Refined pixels go to the checkpoint a batch at a time from each thread
+  std::vector<std::vector<Checkpoint::PixelRecord>> refinedBatches(
+      options.threadCount);
+  parallelFor(items.size(), "Antialiasing:", [&] (uint32_t thread, size_t i) {
+    const auto start = std::chrono::steady_clock::now();
+    int depth;
+    Antialiaser::CacheCounts counts;
+    Colour colour(0);
+    {
+      aov::PixelScope scope(aovImages.get(), items[i].x, items[i].y);
+      colour = antialiaser.antialias(items[i].x, items[i].y, &depth,
+                                     &counts);
+    }
+    cacheCounts[thread].hits += counts.hits;
+    cacheCounts[thread].misses += counts.misses;
+    if (aovImages) {
+      aovImages->setAaDepth(items[i].x, items[i].y, depth);
+    }
+    setPixel(items[i].x, items[i].y, colour);
+    if (checkpoint) {
+      auto& batch = refinedBatches[thread];
+      batch.push_back({items[i].x, items[i].y, colour});
+      if (batch.size() >= Checkpoint::BATCH_SIZE) {
+        checkpoint->addPixels(&batch);
+      }
+    }
+    const std::chrono::duration<double, std::micro> elapsed =
+        std::chrono::steady_clock::now() - start;
+    items[i].cost = elapsed.count();
+    busy[thread] += elapsed.count();
+    if (--bandLeft[items[i].y / ANTIALIAS_BAND_ROWS] == 0) {
+      finishedBands();
+    }
+  });
+  if (checkpoint) {
+    for (auto& batch : refinedBatches) {
+      checkpoint->addPixels(&batch);
+    }
+  }
+
+  if (quiet) return;
+  Antialiaser::CacheCounts counts;
+  for (const auto& mine : cacheCounts) {
+    counts.hits += mine.hits;
+    counts.misses += mine.misses;
+  }
+  antialiaser.printCacheStats(counts);
+
+  double slowest = 0;
+  for (const auto& item : items) {
+    slowest = std::max(slowest, item.cost);
+  }
+  const auto busiest = std::minmax_element(busy.begin(), busy.end());
+  std::cerr << "Antialiased " << items.size() << " pixels, slowest took "
+            << slowest / 1000 << " ms; threads were busy for "
+            << *busiest.first / 1000 << " to " << *busiest.second / 1000
+            << " ms" << std::endl;
+}
+
+void RayTracer::renderAdaptive(const std::string& filename) {
+  const bool progressive = options.snapshotInterval > 0;
+  SampleBuffer samples(imageWidth, imageHeight, progressive);
+  if (checkpoint) {
+    for (const auto& record : checkpoint->samples()) {
+      samples.restore(record.x, record.y, record.stats);
+    }
+  }
+  // Each pass samples a pixel at most once, so what the threads gather
+  // for the checkpoint is the pixel's final state for the pass. It is
+  // handed over once the pass is done, or the batch is full.
+  std::vector<std::vector<Checkpoint::SamplesRecord>> sampledBatches(
+      options.threadCount);
+  auto saveSampled = [&] {
+    if (!checkpoint) return;
+    for (auto& batch : sampledBatches) {
+      checkpoint->addSamples(&batch);
+    }
+  };
+  const size_t pixelCount = imageWidth * imageHeight;
+  const uint64_t maxSamples = (uint64_t) options.sampleBudget * pixelCount;
+
+  std::unique_ptr<SnapshotWriter> snapshots;
+  // Size of the blocks that have a sample in their top left pixel. Pixels
+  // without samples of their own are shown with that one's colour.
+  std::atomic<uint32_t> previewBlock(0);
+  if (progressive) {
+    snapshots.reset(new SnapshotWriter(options.snapshotInterval, [&] {
+      const uint32_t block = previewBlock;
+      if (block == 0) return;
+
+      Image snapshot(imageWidth, imageHeight, 3);
+      fillImage(&snapshot, block,
+                [&] (uint32_t x, uint32_t y, uint32_t* count) {
+        return samples.published(x, y, count);
+      });
+      // Write beside the output and move it over, so that nobody watching
+      // ever sees half an image
+      const std::string temp = filename + ".tmp";
+      if (snapshot.savePng(temp)) {
+        std::rename(temp.c_str(), filename.c_str());
+      }
+    }));
+  }
+
+  // Something coarse to look at soon, refined as it goes. This way a render
+  // that has to stop early still has every part of the image.
+  if (progressive || budget.isLimited()) {
+    for (uint32_t block = COARSEST_BLOCK; block > 1; block /= 2) {
+      const std::string label =
+          "Preview, " + std::to_string(block) + "x" + std::to_string(block) +
+          " blocks:";
+      const size_t rows = (imageHeight + block - 1) / block;
+      parallelFor(rows, label, [&] (uint32_t thread, size_t row) {
+        const uint32_t y = row * block;
+        for (uint32_t x = 0; x < imageWidth; x += block) {
+          if (samples.count(x, y) == 0) {
+            samplePixel(&samples, x, y, 1, &sampledBatches[thread]);
+          }
+        }
+      });
+      saveSampled();
+      if (budget.isExhausted()) break;
+      previewBlock = block;
+    }
+  }
+
+  // Every pixel needs a few samples before its variance means anything
+  parallelFor(imageHeight, "Sampling:", [&] (uint32_t thread, size_t y) {
+    for (uint32_t x = 0; x < imageWidth; ++x) {
+      if (samples.count(x, y) < MIN_PIXEL_SAMPLES) {
+        samplePixel(&samples, x, y, MIN_PIXEL_SAMPLES - samples.count(x, y),
+                    &sampledBatches[thread]);
+      }
+    }
+  });
+  saveSampled();
+  if (!budget.isExhausted()) {
+    previewBlock = 1;
+  }
+  // Resumed pixels may have had more
+  uint64_t spent = 0;
+  for (uint32_t y = 0; y < imageHeight; ++y) {
+    for (uint32_t x = 0; x < imageWidth; ++x) {
+      spent += samples.count(x, y);
+    }
+  }
+
+  // Then keep doubling the samples in the noisiest pixels, noisiest first,
+  // until they are all clean or the sample budget is gone
+  struct Item {
+    uint32_t x, y;
+    double error;
+    uint32_t extra;
+  };
+  size_t rounds = 0;
+  size_t noisy = 0;
+  while (true) {
+    std::vector<Item> items;
+    noisy = 0;
+    for (uint32_t y = 0; y < imageHeight; ++y) {
+      for (uint32_t x = 0; x < imageWidth; ++x) {
+        const double error = samples.error(x, y);
+        if (error <= options.noiseTarget) continue;
+        noisy += 1;
+        if (samples.count(x, y) < MAX_PIXEL_SAMPLES) {
+          items.push_back({x, y, error, samples.count(x, y)});
+        }
+      }
+    }
+    std::sort(items.begin(), items.end(), [] (const Item& a, const Item& b) {
+      return a.error > b.error;
+    });
+
+    // Cut the round off where the sample budget runs out
+    size_t count = 0;
+    for (; count < items.size() && spent < maxSamples; ++count) {
+      auto& item = items[count];
+      item.extra = std::min<uint64_t>(
+          std::min(item.extra, MAX_PIXEL_SAMPLES - item.extra),
+          maxSamples - spent);
+      spent += item.extra;
+    }
+    if (count == 0 || budget.isExhausted()) break;
+
+    rounds += 1;
+    const std::string label =
+        "Sampling, round " + std::to_string(rounds) + ":";
+    parallelFor(count, label, [&] (uint32_t thread, size_t i) {
+      samplePixel(&samples, items[i].x, items[i].y, items[i].extra,
+                  &sampledBatches[thread]);
+    });
+    saveSampled();
+  }
+
+  if (snapshots) {
+    snapshots->stop();
+  }
+
+  const uint32_t block = previewBlock > 0 ? previewBlock.load()
+                                          : COARSEST_BLOCK;
+  fillImage(&finalImage, block,
+            [&] (uint32_t x, uint32_t y, uint32_t* count) {
+    *count = samples.count(x, y);
+    return samples.mean(x, y);
+  });
+
+  // Count what was actually taken, since a render that stopped early did
+  // not spend all it planned to
+  uint64_t taken = 0;
+  for (uint32_t y = 0; y < imageHeight; ++y) {
+    for (uint32_t x = 0; x < imageWidth; ++x) {
+      taken += samples.count(x, y);
+    }
+  }
+
+  if (quiet) return;
+  std::cerr << "Adaptive sampling: " << taken << " samples ("
+            << taken / (double) pixelCount << " per pixel) in " << rounds
+            << " rounds; " << noisy << " pixels still above "
+            << options.noiseTarget << std::endl;
+}
+
+void RayTracer::samplePixel(
+    SampleBuffer* samples, uint32_t x, uint32_t y, uint32_t count,
+    std::vector<Checkpoint::SamplesRecord>* sampled) const {
+  // Seeded by pixel and sample number, so the jitter does not depend on
+  // which thread takes the pixel
+  const uint32_t first = samples->count(x, y);
+  std::minstd_rand rng(
+      ((window.y0 + y) * fullWidth + window.x0 + x) * 7919u + first + 1);
+  std::uniform_real_distribution<double> offset(0, 0.5);
+
+  const auto sx = options.sampleRateX;
+  const auto sy = options.sampleRateY;
+  {
+    aov::PixelScope scope(aovImages.get(), x, y);
+    for (uint32_t n = first; n < first + count; ++n) {
+      // Cycle through the quarters of the pixel so samples stay spread out
+      const double u = (n % 2) * 0.5 + offset(rng);
+      const double v = (n / 2 % 2) * 0.5 + offset(rng);
+      samples->add(x, y, pixelColour((x + u) * sx, (y + v) * sy));
+    }
+  }
+  // Sampled renders go as deep as they take samples
+  if (aovImages) {
+    aovImages->setAaDepth(x, y, samples->count(x, y));
+  }
+  if (checkpoint) {
+    sampled->push_back({x, y, samples->stats(x, y)});
+    if (sampled->size() >= Checkpoint::BATCH_SIZE) {
+      checkpoint->addSamples(sampled);
+    }
+  }
+}
+
+void RayTracer::parallelFor(
+    size_t count, const std::string& label,
+    const std::function<void(uint32_t, size_t)>& work) {
+  if (count == 0) return;
+
+  std::atomic<size_t> next(0);
+  std::atomic<size_t> done(0);
+  const std::string traceName =
+      label.substr(0, label.find_last_not_of(':') + 1);
+  auto run = [&, this] (uint32_t thread) {
+    if (thread > 0 && trace::isRecording()) {
+      trace::nameThread("Render " + std::to_string(thread));
+    }
+    trace::Scope scope(traceName.c_str());
+    size_t i;
+    while (!budget.isExhausted() && (i = next++) < count) {
+      work(thread, i);
+
+      // Only redraw when the percentage changes
+      const auto finished = ++done;
+      if (!quiet &&
+          finished * 100 / count != (finished - 1) * 100 / count) {
+        std::lock_guard<std::mutex> lock(progressMutex);
+        showProgress(label, finished / (double) count);
+      }
+    }
+    counters::flush();
+  };
+
+  std::list<std::thread> threads;
+  for (uint32_t t = 1; t < options.threadCount; ++t) {
+    threads.emplace_back(run, t);
+  }
+  run(0);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+bool RayTracer::render(const std::string& filename) {
+  if (imageWidth == 0 || imageHeight == 0) {
+    std::cerr << "Not rendering " << filename << ": the crop is not inside "
+              << "the image" << std::endl;
+    return false;
+  }
+  // Sampling can stop at any point with all of the image, so progressive and
+  // limited renders use it too. Without a noise target they refine every
+  // pixel until the sample budget runs out.
+  const bool sampling = options.noiseTarget > 0 ||
+                        options.snapshotInterval > 0 || budget.isLimited();
+
+  if (!options.workerSocket.empty()) {
+    work(options.workerSocket, sampling);
+    return true;
+  }
+  // Only count this render, not what came before it in this process
+  counters::collect();
+  // Nor keep the checkpoint of an earlier one
+  checkpoint.reset();
+  if (options.workerProcesses > 0 || !options.coordinatorSocket.empty()) {
+    if (options.aovs != 0) {
+      std::cerr << "Per-pixel images are not collected from workers, so "
+                << "they will not be saved" << std::endl;
+    }
+    coordinate(filename, sampling);
+  }
+  else {
+    if (options.checkpoint || options.resume || options.timeLimit > 0 ||
+        options.rayLimit > 0) {
+      checkpoint.reset(new Checkpoint(filename + ".checkpoint",
+                                      fingerprint(sampling), options.resume,
+                                      imageWidth, imageHeight));
+    }
+    if (options.aovs != 0) {
+      aovImages.reset(new AovImages(options.aovs, imageWidth, imageHeight));
+      if (aovImages->has(AovImages::CELLS) && !uniformGrid) {
+        std::cerr << "Only uniform grids (-g) count cells, so the cells "
+                  << "image will be empty" << std::endl;
+      }
+    }
+    renderPixels(filename, sampling);
+  }
+
+  // Cells visited per grid walk are among the counters
+  if (options.showCounters || !options.countersFile.empty()) {
+    reportCounters();
+  }
+
+  if (budget.isExhausted()) {
+    std::cerr << "Stopped early (" << budget.reason()
+              << "), saving what was rendered" << std::endl;
+  }
+  const auto start = std::chrono::steady_clock::now();
+  finalImage.savePng(filename);
+  trace::record("Save PNG", start);
+  if (options.stats) {
+    addTime(&options.stats->pngEncode, start);
+    options.stats->cameraRays += budget.spent();
+    options.stats->renders += 1;
+  }
+  if (aovImages) {
+    aovImages->save(filename);
+    aovImages.reset();
+  }
+
+  if (!checkpoint) return true;
+  if (budget.isExhausted()) {
+    std::cerr << "Kept checkpoint " << checkpoint->path()
+              << "; render again with --resume to finish" << std::endl;
+  }
+  else {
+    checkpoint->remove();
+  }
+  return true;
+}
 
-  auto pixelColour = colour / (options.sampleRateX * options.sampleRateY);
-  tempImage(xPx, yPx, 0) += pixelColour.R();
-  tempImage(xPx, yPx, 1) += pixelColour.G();
-  tempImage(xPx, yPx, 2) += pixelColour.B();
+void RayTracer::reportCounters() const {
+  if (!counters::enabled) {
+    std::cerr << "Counters are not compiled in; build with make COUNTERS=1 "
+              << "to count rays and intersection tests" << std::endl;
+    return;
+  }
+  const auto counted = counters::collect();
+  std::cerr << counted.report();
+  if (options.countersFile.empty()) return;
+  std::ofstream out(options.countersFile);
+  out << counted.json() << std::endl;
+  if (!out) {
+    std::cerr << "Could not write " << options.countersFile << std::endl;
+  }
 }
 
-void RayTracer::render(const std::string& filename) {
-  // Threading
+void RayTracer::renderPixels(const std::string& filename, bool sampling) {
+  auto start = std::chrono::steady_clock::now();
+  if (sampling) {
+    renderAdaptive(filename);
+    if (options.stats) {
+      addTime(&options.stats->trace, start);
+    }
+    trace::record("Sample", start);
+    return;
+  }
+
+  // Put back the tiles an earlier run finished, and leave them out
+  std::unordered_set<uint64_t> finished;
+  if (checkpoint) {
+    for (const auto& record : checkpoint->tiles()) {
+      const auto& tile = record.tile;
+      size_t i = 0;
+      for (uint32_t y = tile.y0; y < tile.y1; ++y) {
+        for (uint32_t x = tile.x0; x < tile.x1; ++x) {
+          const auto& colour = record.colours[i++];
+          tempImage(x, y, 0) = colour.R();
+          tempImage(x, y, 1) = colour.G();
+          tempImage(x, y, 2) = colour.B();
+        }
+      }
+      finished.insert(((uint64_t) tile.y0 << 32) | tile.x0);
+    }
+  }
+
+  // Threading. Tiles cover the pixels of tempImage, which has one more
+  // row and column than the final image.
+  TileScheduler scheduler(imageWidth + 1, imageHeight + 1,
+                          TILE_SIZE, options.threadCount,
+                          [&] (const Tile& tile) {
+    return finished.count(((uint64_t) tile.y0 << 32) | tile.x0) > 0;
+  });
   std::list<std::thread> threads;
   for (uint32_t id = 1; id <= options.threadCount; ++id) {
-    threads.emplace_back(&RayTracer::threadWork, this, id);
+    threads.emplace_back(&RayTracer::threadWork, this, id, &scheduler);
   }
 
   // Wait for them all to finish
   for (auto& thread : threads) {
     thread.join();
   }
+  if (options.stats) {
+    addTime(&options.stats->trace, start);
+  }
+  trace::record("Trace", start);
+  start = std::chrono::steady_clock::now();
 
   // Now we have the temporary image, we need to get the real deal.
   // Adaptive anti-aliasing techniques up in this.
-  Antialiaser antialiaser(this, &tempImage,
-                          options.aaTolerance, options.aaDepth);
+  antialias();
+  if (options.stats) {
+    addTime(&options.stats->antialias, start);
+  }
+  trace::record("Antialias", start);
+}
+
+void RayTracer::renderWindow(const Tile& tile, bool sampling,
+                             std::vector<Colour>* pixels) {
+  setWindow(tile);
+  renderPixels("", sampling);
+  pixels->clear();
+  for (uint32_t y = 0; y < imageHeight; ++y) {
+    for (uint32_t x = 0; x < imageWidth; ++x) {
+      pixels->emplace_back(finalImage(x, y, 0), finalImage(x, y, 1),
+                           finalImage(x, y, 2));
+    }
+  }
+}
+
+void RayTracer::setWindow(const Tile& tile) {
+  window = tile;
+  imageWidth = window.x1 - window.x0;
+  imageHeight = window.y1 - window.y0;
+  tempImage = Image(imageWidth + 1, imageHeight + 1, 3);
+  finalImage = Image(imageWidth, imageHeight, 3);
+  if (!pixelCosts.empty()) {
+    pixelCosts.assign((imageWidth + 1) * (imageHeight + 1), 0);
+  }
+}
 
-  // Also need to show progress here.
-  for (unsigned y = 0; y < imageHeight; ++y) {
-    for (unsigned x = 0; x < imageHeight; ++x) {
-      Colour finalColour = antialiaser.antialias(x, y);
+void RayTracer::coordinate(const std::string& filename, bool sampling) {
+  const std::string socketPath = options.coordinatorSocket.empty()
+                                     ? filename + ".sock"
+                                     : options.coordinatorSocket;
+  const uint64_t id = fingerprint(sampling);
+  TileCoordinator coordinator(socketPath, id);
 
-      finalImage(x, y, 0) = finalColour.R();
-      finalImage(x, y, 1) = finalColour.G();
-      finalImage(x, y, 2) = finalColour.B();
+  // Forked workers start with the scene already built, and share its memory
+  // with us until someone writes to it
+  std::vector<pid_t> children;
+  const uint32_t workerThreads =
+      std::max(1u, options.threadCount / std::max(1u, options.workerProcesses));
+  for (uint32_t i = 0;
+       coordinator.isListening() && i < options.workerProcesses; ++i) {
+    std::cerr.flush();
+    const pid_t pid = fork();
+    if (pid == 0) {
+      // Ctrl-C is for the coordinator, which then stops handing out tiles
+      std::signal(SIGINT, SIG_IGN);
+      options.threadCount = workerThreads;
+      work(socketPath, sampling);
+      // Skip destructors: the coordinator's socket is not ours to remove
+      _exit(0);
     }
-    showProgress("Antialiasing:", (y + 1) / (double) imageHeight);
+    if (pid < 0) {
+      std::cerr << "Could not start worker: " << std::strerror(errno)
+                << std::endl;
+      break;
+    }
+    coordinator.expectWorker(pid);
+    children.push_back(pid);
+  }
+  if (coordinator.isListening()) {
+    std::cerr << "Coordinating " << children.size() << " workers at "
+              << socketPath << std::endl;
   }
 
-  finalImage.savePng(filename);
+  // Tiles are given out in full image coordinates
+  const Tile whole = window;
+  std::deque<Tile> tiles;
+  TileScheduler scheduler(imageWidth, imageHeight, DISTRIBUTED_TILE_SIZE, 1);
+  Tile tile;
+  while (scheduler.next(0, &tile)) {
+    tiles.push_back({tile.x0 + whole.x0, tile.y0 + whole.y0,
+                     tile.x1 + whole.x0, tile.y1 + whole.y0});
+  }
+  const size_t total = tiles.size();
+
+  // Rendering here moves the window about, so keep the image separate
+  Image image(imageWidth, imageHeight, 3);
+  size_t done = 0;
+  quiet = true;
+  coordinator.run(
+      std::move(tiles),
+      [&] (const Tile& tile, const std::vector<Colour>& pixels) {
+        size_t i = 0;
+        for (uint32_t y = tile.y0; y < tile.y1; ++y) {
+          for (uint32_t x = tile.x0; x < tile.x1; ++x) {
+            image(x - whole.x0, y - whole.y0, 0) = pixels[i].R();
+            image(x - whole.x0, y - whole.y0, 1) = pixels[i].G();
+            image(x - whole.x0, y - whole.y0, 2) = pixels[i].B();
+            i += 1;
+          }
+        }
+        done += 1;
+        showProgress("Tiles:", done / (double) total);
+      },
+      [&] (const Tile& tile, std::vector<Colour>* pixels) {
+        renderWindow(tile, sampling, pixels);
+      },
+      [this] { return budget.isExhausted(); });
+  quiet = false;
+
+  setWindow(whole);
+  finalImage = image;
+  for (const auto pid : children) {
+    waitpid(pid, nullptr, 0);
+  }
+  std::cerr << "Rendered " << done << " of " << total << " tiles" << std::endl;
+}
+
+void RayTracer::work(const std::string& socketPath, bool sampling) {
+  // Only the coordinator shows progress and saves anything
+  quiet = true;
+  options.snapshotInterval = 0;
+  size_t done = 0;
+  const bool finished = runTileWorker(
+      socketPath, fingerprint(sampling),
+      [&] (const Tile& tile, std::vector<Colour>* pixels) {
+        renderWindow(tile, sampling, pixels);
+        if (!budget.isExhausted()) done += 1;
+      },
+      [this] { return budget.isExhausted(); });
+  std::cerr << (finished ? "Finished" : "Stopped") << " working for "
+            << socketPath << " after " << done << " tiles" << std::endl;
 }
 
 Colour RayTracer::pixelColour(double x, double y) const {
+  // From the window to the full image
+  x += window.x0 * options.sampleRateX;
+  y += window.y0 * options.sampleRateY;
   // Invert y
   y = rayHeight() - 1 - y;
   auto worldCoords = pixelTransformer.transform(x, y);
+  budget.spend(1);
+  counters::countRay(RenderCounters::PRIMARY_RAY);
+  aov::countCameraRay();
 
   Ray ray(viewConfig.eye, worldCoords);
   return rayColour(ray, x, y);
 }
 
-void RayTracer::threadWork(uint32_t id) {
-  const auto threadCount = options.threadCount;
-  const auto w = rayWidth();
-  const auto h = rayHeight();
-  for (uint32_t y = 0; y < h; ++y) {
-    for (uint32_t x = (y + id) % options.threadCount; x < w; x += threadCount) {
-      writePixel(x, y, pixelColour(x, y));
+void RayTracer::threadWork(uint32_t id, TileScheduler* scheduler) {
+  if (trace::isRecording()) {
+    trace::nameThread("Render " + std::to_string(id));
+  }
+  // Reused for every tile this thread renders
+  std::vector<Colour> buffer;
+  Tile tile;
+  while (!budget.isExhausted() && scheduler->next(id - 1, &tile)) {
+    {
+      trace::Scope scope("Tile", window.x0 + tile.x0, window.y0 + tile.y0);
+      renderTile(tile, &buffer);
     }
-    showThreadProgress(id, (y + 1) / (double) h);
+    showThreadProgress(id, scheduler->progress(id - 1));
+  }
+  showThreadProgress(id, 1);
+  counters::flush();
+}
+
+void RayTracer::renderTile(const Tile& tile, std::vector<Colour>* buffer) {
+  const auto sx = options.sampleRateX;
+  const auto sy = options.sampleRateY;
+  const auto tileWidth = tile.x1 - tile.x0;
+  buffer->assign(tileWidth * (tile.y1 - tile.y0), Colour(0));
+
+  // Average the supersamples of each pixel in the buffer. Only this thread
+  // touches it, and then it is the only one writing these pixels.
+  for (uint32_t y = tile.y0; y < tile.y1; ++y) {
+    for (uint32_t x = tile.x0; x < tile.x1; ++x) {
+      const auto start = std::chrono::steady_clock::now();
+      // The corner at the top left of a pixel counts towards it. Those
+      // past the last row and column are not counted.
+      aov::PixelScope scope(aovImages.get(), x, y);
+      auto& pixel = (*buffer)[(y - tile.y0) * tileWidth + (x - tile.x0)];
+      for (uint32_t j = 0; j < sy; ++j) {
+        for (uint32_t i = 0; i < sx; ++i) {
+          pixel = pixel + pixelColour(x * sx + i, y * sy + j) / (sx * sy);
+        }
+      }
+      if (!pixelCosts.empty()) {
+        const std::chrono::duration<float, std::micro> elapsed =
+            std::chrono::steady_clock::now() - start;
+        pixelCosts[y * (imageWidth + 1) + x] = elapsed.count();
+      }
+    }
+  }
+
+  for (uint32_t y = tile.y0; y < tile.y1; ++y) {
+    for (uint32_t x = tile.x0; x < tile.x1; ++x) {
+      const auto& pixel = (*buffer)[(y - tile.y0) * tileWidth + (x - tile.x0)];
+      tempImage(x, y, 0) = pixel.R();
+      tempImage(x, y, 1) = pixel.G();
+      tempImage(x, y, 2) = pixel.B();
+    }
+  }
+  if (checkpoint) {
+    checkpoint->addTile(tile, *buffer);
   }
 }
 
 bool RayTracer::getIntersection(const Ray& ray, HitRecord* hitRecord) const {
+  if (bvh) {
+    return bvhIntersection(ray, hitRecord);
+  }
   if (options.uniformGrid) {
     return uniformGridIntersection(ray, hitRecord);
   }
@@ -262,13 +1258,13 @@ bool RayTracer::getIntersection(const Ray& ray, HitRecord* hitRecord) const {
 
 bool
 RayTracer::uniformGridIntersection(const Ray& ray, HitRecord* hitRecord) const {
-  bool hitModel = false;
-  for (const auto* model : uniformGrid->getModels(ray)) {
-    if (model->intersects(ray, hitRecord)) {
-      hitModel = true;
-    }
-  }
-  return hitModel;
+  return uniformGrid->intersects(ray, hitRecord);
+}
+
+bool RayTracer::bvhIntersection(const Ray& ray, HitRecord* hitRecord) const {
+  return bvh->intersects(ray, hitRecord, [&] (uint32_t i) {
+    return bvhModels[i]->intersects(ray, hitRecord);
+  });
 }
 
 bool RayTracer::basicIntersection(const Ray& ray, HitRecord* hitRecord) const {
@@ -281,6 +1277,23 @@ bool RayTracer::basicIntersection(const Ray& ray, HitRecord* hitRecord) const {
   return hitModel;
 }
 
+bool RayTracer::isOccluded(const Ray& ray, double tMin, double tMax) const {
+  if (bvh) {
+    return bvh->occludes(ray, tMin, tMax, [&] (uint32_t i) {
+      return bvhModels[i]->occludes(ray, tMin, tMax);
+    });
+  }
+  if (options.uniformGrid) {
+    return uniformGrid->occludes(ray, tMin, tMax);
+  }
+  for (const auto& model : models) {
+    if (model.occludes(ray, tMin, tMax)) {
+      return true;
+    }
+  }
+  return false;
+}
+
 void RayTracer::extremize(Point3D* dest, const Point3D& data,
                           std::function<double(double, double)> extreme) const {
   (*dest)[0] = extreme((*dest)[0], data[0]);
@@ -302,6 +1315,7 @@ void RayTracer::showProgress(const std::string& msg, double percent) const {
 }
 
 void RayTracer::showThreadProgress(uint32_t id, double percent) {
+  if (quiet) return;
   // Lock
   progressMutex.lock();
   static bool firstPrint = true;
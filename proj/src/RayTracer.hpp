@@ -8,12 +8,19 @@
 #include <vector>
 
 #include "algebra.hpp"
+#include "AovImages.hpp"
+#include "BoundingVolumeHierarchy.hpp"
+#include "Checkpoint.hpp"
 #include "image.hpp"
 #include "lights/Light.hpp"
 #include "Model.hpp"
 #include "PixelTransformer.hpp"
 #include "Ray.hpp"
+#include "RenderBudget.hpp"
+#include "RenderStats.hpp"
+#include "SampleBuffer.hpp"
 #include "scene.hpp"
+#include "TileScheduler.hpp"
 #include "UniformGrid.hpp"
 #include "ViewConfig.hpp"
 
@@ -21,15 +28,66 @@ class HitRecord;
 
 class RayTracer {
  public:
+  // One per core, if we can tell
+  static uint32_t defaultThreadCount();
+
   struct Options {
     uint32_t sampleRateX = 1;
     uint32_t sampleRateY = 1;
-    uint32_t threadCount = 4;
+    uint32_t threadCount = defaultThreadCount();
     bool phongInterpolation = false;
     bool uniformGrid = false;
     uint32_t uniformGridSizeFactor = 8;
+    // 1 for a plain uniform grid
+    uint32_t uniformGridLevels = 1;
+    bool splitMeshes = false;
+    bool boundingVolumeHierarchy = false;
     double aaTolerance = 0.2;
     int aaDepth = 0;
+    // If set, sample each pixel until the standard error of its colour is
+    // below this, instead of the main pass and antialiasing
+    double noiseTarget = 0;
+    // Average samples per pixel that noiseTarget may spend
+    uint32_t sampleBudget = 64;
+    // If set, render progressively, replacing the output image with the
+    // current state every this many seconds
+    double snapshotInterval = 0;
+    // Stop early and save what has been rendered after this many seconds
+    // (counted from when the RayTracer is made, or the view last set) or
+    // camera rays. 0 for no limit. Limited renders sample coarse to fine,
+    // so they can stop anywhere.
+    double timeLimit = 0;
+    uint64_t rayLimit = 0;
+    // If given, stop early once this is set
+    const std::atomic<bool>* cancelled = nullptr;
+    // Keep a checkpoint of the render beside the image while it runs, and
+    // leave it there if the render stops early. Implied by resume and by
+    // either limit.
+    bool checkpoint = false;
+    // Pick up from the checkpoint an earlier render of the same image left
+    bool resume = false;
+    // The scene file, if any. Checkpoints from before it was last changed
+    // are not resumed.
+    std::string sceneFile;
+    // If not empty, only render these pixels of the image. They come out
+    // exactly as they would in the full image.
+    Tile crop = {0, 0, 0, 0};
+    // Fork this many worker processes and hand them tiles over a socket
+    uint32_t workerProcesses = 0;
+    // Where to listen for workers. Defaults to the output name with .sock
+    // on the end when there are worker processes.
+    std::string coordinatorSocket;
+    // If set, do not render the image but work for the coordinator here
+    std::string workerSocket;
+    // If given, add where the time of each render goes to this. Time spent
+    // by worker processes is not counted.
+    RenderStats* stats = nullptr;
+    // Report what the render counted (see RenderCounters) when it is done,
+    // on stderr, and as JSON to countersFile if set
+    bool showCounters = false;
+    std::string countersFile;
+    // Kinds of AovImages to save beside the output, a bit (1 << kind) each
+    uint32_t aovs = 0;
     size_t shadowSamples = 1;
     size_t recursiveDepthLimit = 2;
     size_t glossyReflection = 1;
@@ -43,19 +101,37 @@ class RayTracer {
             const Options& options_);
 
   Colour pixelColour(double x, double y) const;
-  void render(const std::string& filename);
+  // Returns false, having said why, if nothing could be rendered. Renders
+  // that stop early still count.
+  bool render(const std::string& filename);
+
+  // Move the camera for the next frame of an animation. The models and
+  // what is built over them are kept unless they were culled for this
+  // view. The budget starts over.
+  void setView(const ViewConfig& viewConfig);
 
  private:
+  // Size of the full image, which sets up the view
+  uint32_t fullWidth, fullHeight;
+  // The part of it being rendered. Everything else works in its coordinates.
+  Tile window;
   uint32_t imageWidth, imageHeight;
   ViewConfig viewConfig;
   Colour ambientColour;
   std::list<Light*> lights;
   Image tempImage;
+  // Time spent tracing each pixel of tempImage, in microseconds. Only kept
+  // when antialiasing, to guess which pixels will be slow to refine.
+  std::vector<float> pixelCosts;
   Image finalImage;
   Options options;
+  RenderBudget budget;
   PixelTransformer pixelTransformer;
 
+  SceneNode* sceneRoot;
   std::list<Model> models;
+  // Set if models outside the crop were dropped, which depends on the view
+  bool culled = false;
 
   // Used to create a bounding box for the scene
   Point3D minPoint;
@@ -63,13 +139,65 @@ class RayTracer {
 
   std::unique_ptr<UniformGrid> uniformGrid = nullptr;
 
-  // Account for supersampling
-  uint32_t rayHeight() const { return (imageHeight + 1) * options.sampleRateY; }
-  uint32_t rayWidth() const { return (imageWidth + 1) * options.sampleRateX; }
+  // The BVH refers to models by index, so it needs them in a vector. That
+  // also lets a later render with models of the same bounds reuse it.
+  std::vector<const Model*> bvhModels;
+  std::shared_ptr<const BoundingVolumeHierarchy> bvh = nullptr;
+
+  // Set while rendering tiles for a coordinator, which shows the progress
+  bool quiet = false;
 
-  void threadWork(uint32_t id);
+  // What each pixel cost, while a render that wants them is going
+  std::unique_ptr<AovImages> aovImages = nullptr;
+
+  // Finished work is recorded here as the render goes
+  std::unique_ptr<Checkpoint> checkpoint = nullptr;
+  // Identifies renders that would make the same image, as far as the
+  // options go. Checkpoints are only resumed by matching renders.
+  uint64_t fingerprint(bool sampling) const;
+
+  // Account for supersampling
+  uint32_t rayHeight() const { return (fullHeight + 1) * options.sampleRateY; }
+  uint32_t rayWidth() const { return (fullWidth + 1) * options.sampleRateX; }
+
+  // Fill finalImage, saving snapshots to filename if progressive
+  void renderPixels(const std::string& filename, bool sampling);
+  // Render just tile of the full image into pixels, row by row. Leaves the
+  // window at tile.
+  void renderWindow(const Tile& tile, bool sampling,
+                    std::vector<Colour>* pixels);
+  // Move the window to tile, with fresh images to match
+  void setWindow(const Tile& tile);
+  // Say what was counted since the last report
+  void reportCounters() const;
+  // Hand tiles out to worker processes and put together what they send back
+  void coordinate(const std::string& filename, bool sampling);
+  // Render tiles for the coordinator at socketPath until it has no more
+  void work(const std::string& socketPath, bool sampling);
+
+  void threadWork(uint32_t id, TileScheduler* scheduler);
+  void renderTile(const Tile& tile, std::vector<Colour>* buffer);
+  // Fill finalImage from tempImage, tracing more rays where needed
+  void antialias();
+  // Fill finalImage by sampling where the noise is worst, within budget.
+  // Progressive renders save snapshots to filename along the way.
+  void renderAdaptive(const std::string& filename);
+  // Add count jittered samples to pixel (x, y) of samples, and its new
+  // state to sampled for the checkpoint
+  void samplePixel(SampleBuffer* samples, uint32_t x, uint32_t y,
+                   uint32_t count,
+                   std::vector<Checkpoint::SamplesRecord>* sampled) const;
+  // Run work(thread, i) for each i in [0, count) on every thread, handing
+  // out one i at a time. Stops handing them out once the budget is spent.
+  void parallelFor(size_t count, const std::string& label,
+                   const std::function<void(uint32_t, size_t)>& work);
+  // Find the models in sceneRoot and build the intersection structure
+  void buildScene();
   void extractModels(SceneNode* root);
   void extractModels(SceneNode* root, const Matrix4x4& inverse);
+  // Drop models that cannot affect the window, when that can be told
+  void cullModels();
+  void buildBvh();
 
   Colour rayColour(const Ray& ray, double x, double y,
                    size_t depth = 0,
@@ -77,14 +205,18 @@ class RayTracer {
                    double refractionIndex = 1) const;
   Colour backgroundColour(double x, double y) const;
 
-  void writePixel(uint32_t x, uint32_t y, const Colour& colour);
   // Get the intersection of ray with models. Uses a particular implementation.
   bool getIntersection(const Ray& ray, HitRecord* hitRecord) const;
 
   // Particular implementations of the intersection component
   bool uniformGridIntersection(const Ray& ray, HitRecord* hitRecord) const;
+  bool bvhIntersection(const Ray& ray, HitRecord* hitRecord) const;
   bool basicIntersection(const Ray& ray, HitRecord* hitRecord) const;
 
+  // Whether anything blocks ray with tMin < t < tMax. Cheaper than
+  // getIntersection, since any blocker will do.
+  bool isOccluded(const Ray& ray, double tMin, double tMax) const;
+
   // Make dest extreme regarding data. Extremize the coords individually,
   // according to the given function
   void extremize(Point3D* dest, const Point3D& data,
@@ -0,0 +1,43 @@
+#include "RenderBudget.hpp"
+
+RenderBudget::RenderBudget(double timeLimit_, uint64_t rayLimit_,
+                           const std::atomic<bool>* cancelled_,
+                           bool countRays)
+    : timeLimit(timeLimit_), hasDeadline(timeLimit > 0),
+      deadline(Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                                  std::chrono::duration<double>(timeLimit))),
+      rayLimit(rayLimit_), counting(rayLimit > 0 || countRays),
+      cancelled(cancelled_), raysSpent(0) {}
+
+bool RenderBudget::isLimited() const {
+  return hasDeadline || rayLimit > 0;
+}
+
+bool RenderBudget::isExhausted() const {
+  if (cancelled && *cancelled) return true;
+  if (rayLimit > 0 && raysSpent.load(std::memory_order_relaxed) >= rayLimit) {
+    return true;
+  }
+  return hasDeadline && Clock::now() >= deadline;
+}
+
+std::string RenderBudget::reason() const {
+  if (cancelled && *cancelled) return "cancelled";
+  if (rayLimit > 0 && raysSpent >= rayLimit) {
+    return "ray limit of " + std::to_string(rayLimit) + " reached";
+  }
+  if (hasDeadline && Clock::now() >= deadline) return "out of time";
+  return "not exhausted";
+}
+
+void RenderBudget::restart() {
+  deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                                std::chrono::duration<double>(timeLimit));
+  raysSpent = 0;
+}
+
+void RenderBudget::spend(uint64_t rays) const {
+  if (counting) {
+    raysSpent.fetch_add(rays, std::memory_order_relaxed);
+  }
+}
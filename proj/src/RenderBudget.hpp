@@ -0,0 +1,45 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Limits on how long a render may run. Once one is reached, the render
+// finishes the work it has in hand and saves what it has.
+class RenderBudget {
+ public:
+  // timeLimit is in seconds from now and rayLimit counts camera rays; 0 for
+  // no limit. cancelled, if given, stops the render once set. It is only
+  // ever read, so a signal handler may set it. Rays are only counted when
+  // there is a ray limit, or countRays is set.
+  RenderBudget(double timeLimit, uint64_t rayLimit,
+               const std::atomic<bool>* cancelled, bool countRays = false);
+
+  // Whether there is a time or ray limit, as opposed to only cancellation
+  bool isLimited() const;
+  // Whether to stop taking on work
+  bool isExhausted() const;
+  // Why the budget is exhausted, for the log
+  std::string reason() const;
+
+  // Count rays traced against the limit. Safe from any thread.
+  void spend(uint64_t rays) const;
+  // Rays counted since the start
+  uint64_t spent() const { return raysSpent; }
+
+  // Start over: the time limit counts from now and no rays are spent. For
+  // the next frame of an animation.
+  void restart();
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  const double timeLimit;
+  const bool hasDeadline;
+  Clock::time_point deadline;
+  const uint64_t rayLimit;
+  const bool counting;
+  const std::atomic<bool>* const cancelled;
+  mutable std::atomic<uint64_t> raysSpent;
+};
@@ -0,0 +1,106 @@
+#include "RenderCounters.hpp"
+
+#include <mutex>
+#include <sstream>
+
+namespace {
+
+const char* const RAY_NAMES[RenderCounters::RAY_KINDS] = {
+  "primary", "shadow", "reflected", "glossy", "refracted",
+};
+
+const char* const PRIMITIVE_NAMES[RenderCounters::PRIMITIVE_KINDS] = {
+  "sphere", "cube", "cylinder", "torus", "mesh", "mesh_face",
+};
+
+#ifdef RT_COUNTERS
+std::mutex totalMutex;
+RenderCounters total;
+#endif
+
+// Write the counts of each kind as "name": count pairs
+template <size_t N>
+void jsonCounts(std::ostream& out, const uint64_t (&counts)[N],
+                const char* const (&names)[N]) {
+  out << "{";
+  for (size_t i = 0; i < N; ++i) {
+    out << (i > 0 ? ", " : "") << "\"" << names[i] << "\": " << counts[i];
+  }
+  out << "}";
+}
+
+} // Anonymous
+
+void RenderCounters::add(const RenderCounters& other) {
+  for (int i = 0; i < RAY_KINDS; ++i) {
+    rays[i] += other.rays[i];
+  }
+  for (int i = 0; i < PRIMITIVE_KINDS; ++i) {
+    intersects[i] += other.intersects[i];
+    occludes[i] += other.occludes[i];
+  }
+  gridWalks += other.gridWalks;
+  cellsVisited += other.cellsVisited;
+  hitUpdates += other.hitUpdates;
+}
+
+std::string RenderCounters::report() const {
+  std::ostringstream out;
+  out << "Rays:";
+  for (int i = 0; i < RAY_KINDS; ++i) {
+    out << (i > 0 ? ", " : " ") << rays[i] << " " << RAY_NAMES[i];
+  }
+  out << std::endl;
+  for (int i = 0; i < PRIMITIVE_KINDS; ++i) {
+    if (intersects[i] == 0 && occludes[i] == 0) continue;
+    out << "Tests against " << PRIMITIVE_NAMES[i] << ": " << intersects[i]
+        << " intersects, " << occludes[i] << " occludes" << std::endl;
+  }
+  if (gridWalks > 0) {
+    out << "Grid: " << gridWalks << " walks visited " << cellsVisited
+        << " cells (" << cellsVisited / (double) gridWalks << " per walk)"
+        << std::endl;
+  }
+  out << "Closer hits: " << hitUpdates << std::endl;
+  return out.str();
+}
+
+std::string RenderCounters::json() const {
+  std::ostringstream out;
+  out << "{\"rays\": ";
+  jsonCounts(out, rays, RAY_NAMES);
+  out << ", \"intersects\": ";
+  jsonCounts(out, intersects, PRIMITIVE_NAMES);
+  out << ", \"occludes\": ";
+  jsonCounts(out, occludes, PRIMITIVE_NAMES);
+  out << ", \"grid_walks\": " << gridWalks
+      << ", \"cells_visited\": " << cellsVisited
+      << ", \"hit_updates\": " << hitUpdates << "}";
+  return out.str();
+}
+
+namespace counters {
+
+#ifdef RT_COUNTERS
+thread_local RenderCounters local;
+
+void flush() {
+  std::lock_guard<std::mutex> lock(totalMutex);
+  total.add(local);
+  local = RenderCounters();
+}
+
+RenderCounters collect() {
+  flush();
+  std::lock_guard<std::mutex> lock(totalMutex);
+  const RenderCounters counted = total;
+  total = RenderCounters();
+  return counted;
+}
+#else
+RenderCounters collect() {
+  return RenderCounters();
+}
+#endif
+
+}
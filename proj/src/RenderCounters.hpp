@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Counts of the work a render does: rays of each kind, intersection tests
+// against each kind of primitive, and so on.
+//
+// Counting is only compiled in with RT_COUNTERS defined (make COUNTERS=1).
+// Without it the count functions below are empty and cost nothing. With it
+// each thread counts into its own copy, and flushes it into the total once
+// it is done, so counting takes no locks.
+struct RenderCounters {
+  enum RayKind {
+    PRIMARY_RAY,
+    SHADOW_RAY,
+    REFLECTED_RAY,
+    GLOSSY_RAY,
+    REFRACTED_RAY,
+    RAY_KINDS
+  };
+  enum PrimitiveKind {
+    SPHERE,
+    CUBE,
+    CYLINDER,
+    TORUS,
+    MESH,
+    // Single faces, whether tested within a mesh or split into a grid
+    MESH_FACE,
+    PRIMITIVE_KINDS
+  };
+
+  uint64_t rays[RAY_KINDS];
+  // Calls to intersects, for the closest hit
+  uint64_t intersects[PRIMITIVE_KINDS];
+  // Calls to occludes, for any hit
+  uint64_t occludes[PRIMITIVE_KINDS];
+  // Rays walked through a uniform grid, and the cells they visited
+  uint64_t gridWalks;
+  uint64_t cellsVisited;
+  // Hits closer than any found before for the ray
+  uint64_t hitUpdates;
+
+  void add(const RenderCounters& other);
+  // As a line per kind of count, for people
+  std::string report() const;
+  // As a JSON object
+  std::string json() const;
+};
+
+namespace counters {
+
+#ifdef RT_COUNTERS
+const bool enabled = true;
+
+// What this thread has counted since it last flushed. Zero before first use,
+// so reaching it needs no initialisation check.
+extern thread_local RenderCounters local;
+
+inline void countRay(RenderCounters::RayKind kind) {
+  local.rays[kind] += 1;
+}
+inline void countIntersects(RenderCounters::PrimitiveKind kind) {
+  local.intersects[kind] += 1;
+}
+inline void countOccludes(RenderCounters::PrimitiveKind kind) {
+  local.occludes[kind] += 1;
+}
+inline void countGridWalk(uint64_t cells) {
+  local.gridWalks += 1;
+  local.cellsVisited += cells;
+}
+inline void countHitUpdate() {
+  local.hitUpdates += 1;
+}
+
+// Add what this thread has counted to the total, and start it over.
+// Threads that count must do this before they finish.
+void flush();
+#else
+const bool enabled = false;
+
+inline void countRay(RenderCounters::RayKind) {}
+inline void countIntersects(RenderCounters::PrimitiveKind) {}
+inline void countOccludes(RenderCounters::PrimitiveKind) {}
+inline void countGridWalk(uint64_t) {}
+inline void countHitUpdate() {}
+inline void flush() {}
+#endif
+
+// Everything flushed since the last collect, along with what this thread
+// has counted, and start over
+RenderCounters collect();
+
+}
@@ -0,0 +1,237 @@
+#include "RenderServer.hpp"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#include "LocalSocket.hpp"
+
+namespace {
+
+const uint32_t MAGIC = 0x424a5452; // "RTJB"
+
+// How often the client checks whether it has been interrupted, in ms
+const int POLL_TIMEOUT = 100;
+
+// Sent along with the client's stderr. The strings follow: the client's
+// working directory, then its arguments.
+struct JobHeader {
+  uint32_t magic;
+  uint32_t count;
+};
+
+bool sendString(int socket, const std::string& s) {
+  const uint32_t size = s.size();
+  return sendAll(socket, &size, sizeof(size)) &&
+         sendAll(socket, s.data(), size);
+}
+
+bool receiveString(int socket, std::string* s) {
+  uint32_t size;
+  if (!receiveAll(socket, &size, sizeof(size))) return false;
+  s->resize(size);
+  return size == 0 || receiveAll(socket, &(*s)[0], size);
+}
+
+// The header goes with a file descriptor, which the other end gets its own
+// copy of
+bool sendHeader(int socket, const JobHeader& header, int fd) {
+  iovec data = {const_cast<JobHeader*>(&header), sizeof(header)};
+  char control[CMSG_SPACE(sizeof(int))];
+  std::memset(control, 0, sizeof(control));
+
+  msghdr message;
+  std::memset(&message, 0, sizeof(message));
+  message.msg_iov = &data;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+
+  cmsghdr* fdMessage = CMSG_FIRSTHDR(&message);
+  fdMessage->cmsg_level = SOL_SOCKET;
+  fdMessage->cmsg_type = SCM_RIGHTS;
+  fdMessage->cmsg_len = CMSG_LEN(sizeof(int));
+  std::memcpy(CMSG_DATA(fdMessage), &fd, sizeof(int));
+
+  return sendmsg(socket, &message, MSG_NOSIGNAL) == sizeof(header);
+}
+
+bool receiveHeader(int socket, JobHeader* header, int* fd) {
+  iovec data = {header, sizeof(*header)};
+  char control[CMSG_SPACE(sizeof(int))];
+
+  msghdr message;
+  std::memset(&message, 0, sizeof(message));
+  message.msg_iov = &data;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+
+  *fd = -1;
+  if (recvmsg(socket, &message, 0) != sizeof(*header)) return false;
+  cmsghdr* fdMessage = CMSG_FIRSTHDR(&message);
+  if (fdMessage && fdMessage->cmsg_level == SOL_SOCKET &&
+      fdMessage->cmsg_type == SCM_RIGHTS) {
+    std::memcpy(fd, CMSG_DATA(fdMessage), sizeof(int));
+  }
+  return *fd >= 0 && header->magic == MAGIC;
+}
+
+} // Anonymous
+
+RenderServer::RenderServer(const std::string& socketPath_)
+    : socketPath(socketPath_), listener(listenAt(socketPath)) {
+  char cwd[PATH_MAX];
+  if (getcwd(cwd, sizeof(cwd))) {
+    directory = cwd;
+  }
+}
+
+RenderServer::~RenderServer() {
+  if (listener >= 0) {
+    close(listener);
+    unlink(socketPath.c_str());
+  }
+}
+
+void RenderServer::run(const JobFn& job, std::atomic<bool>* cancelled) {
+  // Clients that go away must not take the server with them
+  std::signal(SIGPIPE, SIG_IGN);
+
+  std::cerr << "Serving renders at " << socketPath << std::endl;
+  while (listener >= 0) {
+    const int client = accept(listener, nullptr, nullptr);
+    if (client < 0) {
+      if (errno == EINTR) continue;
+      std::cerr << "Waiting for jobs failed: " << std::strerror(errno)
+                << std::endl;
+      return;
+    }
+    serve(client, job, cancelled);
+    close(client);
+  }
+}
+
+void RenderServer::serve(int client, const JobFn& job,
+                         std::atomic<bool>* cancelled) {
+  JobHeader header;
+  int clientErr;
+  std::string clientDirectory;
+  std::vector<std::string> args;
+  bool ok = receiveHeader(client, &header, &clientErr) &&
+            receiveString(client, &clientDirectory);
+  for (uint32_t i = 1; ok && i < header.count; ++i) {
+    args.emplace_back();
+    ok = receiveString(client, &args.back());
+  }
+  if (!ok) {
+    std::cerr << "Ignoring a job that did not arrive whole" << std::endl;
+    if (clientErr >= 0) close(clientErr);
+    return;
+  }
+
+  jobCount += 1;
+  std::cerr << "Job " << jobCount << ":";
+  for (const auto& arg : args) {
+    std::cerr << " " << arg;
+  }
+  std::cerr << std::endl;
+  const auto start = std::chrono::steady_clock::now();
+
+  // From here until the job is done, everything we say goes to the client
+  std::fflush(stderr);
+  const int serverErr = dup(STDERR_FILENO);
+  dup2(clientErr, STDERR_FILENO);
+  close(clientErr);
+
+  // The client sends a byte to cancel, and hangs up if it dies. Either
+  // wakes this up, as does shutting down our end once the job is done.
+  *cancelled = false;
+  std::thread watcher([client, cancelled] {
+    char byte;
+    recv(client, &byte, 1, 0);
+    *cancelled = true;
+  });
+
+  int status = 1;
+  if (chdir(clientDirectory.c_str()) != 0) {
+    std::cerr << "Could not change to " << clientDirectory << ": "
+              << std::strerror(errno) << std::endl;
+  }
+  else {
+    status = job(args);
+  }
+
+  std::cerr.flush();
+  std::fflush(stderr);
+  dup2(serverErr, STDERR_FILENO);
+  close(serverErr);
+  if (!directory.empty() && chdir(directory.c_str()) != 0) {
+    std::cerr << "Could not go back to " << directory << std::endl;
+  }
+
+  shutdown(client, SHUT_RD);
+  watcher.join();
+  const int32_t result = status;
+  sendAll(client, &result, sizeof(result));
+
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::cerr << "Job " << jobCount << " finished with status " << status
+            << " in " << elapsed.count() << " s" << std::endl;
+}
+
+int submitRenderJob(const std::string& socketPath,
+                    const std::vector<std::string>& args,
+                    const std::atomic<bool>& interrupted) {
+  const int server = connectTo(socketPath);
+  if (server < 0) return 1;
+
+  char directory[PATH_MAX];
+  if (!getcwd(directory, sizeof(directory))) {
+    std::cerr << "Could not get the working directory: "
+              << std::strerror(errno) << std::endl;
+    close(server);
+    return 1;
+  }
+
+  const JobHeader header = {MAGIC, (uint32_t) args.size() + 1};
+  bool ok = sendHeader(server, header, STDERR_FILENO) &&
+            sendString(server, directory);
+  for (size_t i = 0; ok && i < args.size(); ++i) {
+    ok = sendString(server, args[i]);
+  }
+
+  bool cancelSent = false;
+  while (ok) {
+    if (interrupted && !cancelSent) {
+      const char cancel = 1;
+      sendAll(server, &cancel, 1);
+      cancelSent = true;
+    }
+
+    pollfd fd = {server, POLLIN, 0};
+    const int ready = poll(&fd, 1, POLL_TIMEOUT);
+    if (ready < 0 && errno != EINTR) break;
+    if (ready <= 0) continue;
+
+    int32_t status;
+    if (!receiveAll(server, &status, sizeof(status))) break;
+    close(server);
+    return status;
+  }
+
+  std::cerr << "Lost the render server at " << socketPath << std::endl;
+  close(server);
+  return 1;
+}
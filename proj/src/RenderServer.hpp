@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Runs render jobs sent by rt --submit, one at a time, in this process.
+// Textures, meshes and the last BVH stay loaded from one job to the next
+// (see AssetCache), so a job that changes the camera or the options gets
+// to tracing rays much sooner than a fresh rt would.
+class RenderServer {
+ public:
+  // Do one job, given the client's arguments without the program name.
+  // Returns its exit status.
+  typedef std::function<int(const std::vector<std::string>&)> JobFn;
+
+  explicit RenderServer(const std::string& socketPath);
+  // Stops listening and removes the socket
+  ~RenderServer();
+
+  bool isListening() const { return listener >= 0; }
+
+  // Run jobs until the process is killed. While one runs, stderr is the
+  // client's, the working directory is the client's, and *cancelled is
+  // set if the client is interrupted or goes away.
+  void run(const JobFn& job, std::atomic<bool>* cancelled);
+
+ private:
+  const std::string socketPath;
+  int listener = -1;
+  // Where to go back to after each job
+  std::string directory;
+  size_t jobCount = 0;
+
+  void serve(int client, const JobFn& job, std::atomic<bool>* cancelled);
+};
+
+// Have the server at socketPath run a job with args, and wait for it to
+// finish. Its messages come out on our stderr. Once interrupted is set the
+// job is cancelled, and saves what it has. Returns the job's exit status.
+int submitRenderJob(const std::string& socketPath,
+                    const std::vector<std::string>& args,
+                    const std::atomic<bool>& interrupted);
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+
+// Where the time of a render goes, for benchmarks. Times are wall clock
+// seconds. Every render given the same stats adds to them.
+struct RenderStats {
+  // Running the scene script up to the render
+  double sceneLoad = 0;
+  // Finding the models in the scene graph, and culling them
+  double extraction = 0;
+  // Building the grid or BVH
+  double accelBuild = 0;
+  // The main pass, or all of the sampling for adaptive renders
+  double trace = 0;
+  double antialias = 0;
+  double pngEncode = 0;
+  uint64_t cameraRays = 0;
+  uint32_t renders = 0;
+};
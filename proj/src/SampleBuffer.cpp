@@ -0,0 +1,72 @@
+#include "SampleBuffer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+SampleBuffer::SampleBuffer(uint32_t width, uint32_t height, bool publish)
+    : m_width(width), m_height(height), pixels(width * height),
+      publishedPixels(publish ? width * height : 0) {
+  for (auto& pixel : publishedPixels) {
+    for (auto& channel : pixel.mean) {
+      channel.store(0, std::memory_order_relaxed);
+    }
+    pixel.count.store(0, std::memory_order_relaxed);
+  }
+}
+
+void SampleBuffer::add(uint32_t x, uint32_t y, const Colour& colour) {
+  auto& pixel = pixels[y * m_width + x];
+  pixel.count += 1;
+  const double values[3] = {colour.R(), colour.G(), colour.B()};
+  for (int i = 0; i < 3; ++i) {
+    const double delta = values[i] - pixel.mean[i];
+    pixel.mean[i] += delta / pixel.count;
+    pixel.m2[i] += delta * (values[i] - pixel.mean[i]);
+  }
+  publish(x, y);
+}
+
+void SampleBuffer::restore(uint32_t x, uint32_t y, const Stats& stats) {
+  pixels[y * m_width + x] = stats;
+  publish(x, y);
+}
+
+void SampleBuffer::publish(uint32_t x, uint32_t y) {
+  if (publishedPixels.empty()) return;
+  const auto& pixel = pixels[y * m_width + x];
+  auto& out = publishedPixels[y * m_width + x];
+  for (int i = 0; i < 3; ++i) {
+    out.mean[i].store(pixel.mean[i], std::memory_order_relaxed);
+  }
+  out.count.store(pixel.count, std::memory_order_relaxed);
+}
+
+uint32_t SampleBuffer::count(uint32_t x, uint32_t y) const {
+  return stats(x, y).count;
+}
+
+Colour SampleBuffer::mean(uint32_t x, uint32_t y) const {
+  const auto& pixel = stats(x, y);
+  return Colour(pixel.mean[0], pixel.mean[1], pixel.mean[2]);
+}
+
+double SampleBuffer::error(uint32_t x, uint32_t y) const {
+  const auto& pixel = stats(x, y);
+  if (pixel.count < 2) {
+    return std::numeric_limits<double>::infinity();
+  }
+  double variance = 0;
+  for (int i = 0; i < 3; ++i) {
+    variance = std::max(variance, pixel.m2[i] / (pixel.count - 1));
+  }
+  return std::sqrt(variance / pixel.count);
+}
+
+Colour SampleBuffer::published(uint32_t x, uint32_t y, uint32_t* count) const {
+  const auto& pixel = publishedPixels[y * m_width + x];
+  *count = pixel.count.load(std::memory_order_relaxed);
+  return Colour(pixel.mean[0].load(std::memory_order_relaxed),
+                pixel.mean[1].load(std::memory_order_relaxed),
+                pixel.mean[2].load(std::memory_order_relaxed));
+}
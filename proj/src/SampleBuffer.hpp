@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "algebra.hpp"
+
+// Running mean and variance of the samples taken in each pixel of an image
+// (Welford's method). A pixel may only be added to by one thread at a time.
+class SampleBuffer {
+ public:
+  // Everything known about one pixel
+  struct Stats {
+    uint32_t count = 0;
+    double mean[3] = {0, 0, 0};
+    // Sum of squared differences from the mean
+    double m2[3] = {0, 0, 0};
+  };
+
+  // If publish is set, each pixel's mean is also kept where other threads
+  // may read it at any time, through published()
+  SampleBuffer(uint32_t width, uint32_t height, bool publish = false);
+
+  void add(uint32_t x, uint32_t y, const Colour& colour);
+  // Put back what stats(x, y) gave, e.g. in an earlier run
+  void restore(uint32_t x, uint32_t y, const Stats& stats);
+
+  uint32_t count(uint32_t x, uint32_t y) const;
+  Colour mean(uint32_t x, uint32_t y) const;
+  // Estimated standard error of the mean, in the worst channel. Infinite
+  // until there are at least two samples.
+  double error(uint32_t x, uint32_t y) const;
+  const Stats& stats(uint32_t x, uint32_t y) const {
+    return pixels[y * m_width + x];
+  }
+
+  // The latest mean and sample count of a pixel. Safe to call while other
+  // threads add samples, though the channels may be from different moments.
+  Colour published(uint32_t x, uint32_t y, uint32_t* count) const;
+
+  uint32_t width() const { return m_width; }
+  uint32_t height() const { return m_height; }
+
+ private:
+  const uint32_t m_width;
+  const uint32_t m_height;
+  std::vector<Stats> pixels;
+
+  struct PublishedPixel {
+    std::atomic<float> mean[3];
+    std::atomic<uint32_t> count;
+  };
+  // Empty unless publishing
+  std::vector<PublishedPixel> publishedPixels;
+  void publish(uint32_t x, uint32_t y);
+};
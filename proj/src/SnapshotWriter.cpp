@@ -0,0 +1,33 @@
+#include "SnapshotWriter.hpp"
+
+SnapshotWriter::SnapshotWriter(double interval_, std::function<void()> write_)
+    : interval(interval_), write(std::move(write_)),
+      thread(&SnapshotWriter::run, this) {}
+
+SnapshotWriter::~SnapshotWriter() {
+  stop();
+}
+
+void SnapshotWriter::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopped = true;
+  }
+  wake.notify_all();
+  if (thread.joinable()) {
+    thread.join();
+  }
+}
+
+void SnapshotWriter::run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    // Sleep for the interval, unless told to stop first
+    if (wake.wait_for(lock, interval, [this] { return stopped; })) {
+      return;
+    }
+    lock.unlock();
+    write();
+    lock.lock();
+  }
+}
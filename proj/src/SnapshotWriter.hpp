@@ -0,0 +1,30 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Calls write every interval seconds on a thread of its own until stopped,
+// so that slow writes do not hold up whoever produces the data
+class SnapshotWriter {
+ public:
+  SnapshotWriter(double interval, std::function<void()> write);
+  // Stops the writer
+  ~SnapshotWriter();
+
+  // Waits for a write in progress, if any. No more writes happen after.
+  void stop();
+
+ private:
+  const std::chrono::duration<double> interval;
+  const std::function<void()> write;
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stopped = false;
+  std::thread thread;
+
+  void run();
+};
@@ -0,0 +1,307 @@
+#include "TileCoordinator.hpp"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+
+#include "LocalSocket.hpp"
+
+namespace {
+
+const uint32_t MAGIC = 0x4b575452; // "RTWK"
+
+// How long to wait for workers before checking on everything else, in ms
+const int POLL_TIMEOUT = 100;
+
+// How long a worker has to say hello once started or connected, and to
+// finish a tile. Far longer than either should take: a worker past them is
+// stuck, not slow.
+const std::chrono::seconds GREETING_TIMEOUT(10);
+const std::chrono::seconds TILE_TIMEOUT(300);
+
+// The first thing a worker sends
+struct Hello {
+  uint32_t magic;
+  uint32_t pid;
+  uint64_t fingerprint;
+};
+
+// Sent instead of a tile once there is no more work
+const Tile NO_TILE = {0, 0, 0, 0};
+
+bool isEmpty(const Tile& tile) {
+  return tile.x1 <= tile.x0 || tile.y1 <= tile.y0;
+}
+
+size_t resultSize(const Tile& tile) {
+  return sizeof(Tile) +
+         (tile.x1 - tile.x0) * (tile.y1 - tile.y0) * 3 * sizeof(double);
+}
+
+} // Anonymous
+
+TileCoordinator::TileCoordinator(const std::string& socketPath_,
+                                 uint64_t fingerprint_)
+    : socketPath(socketPath_), fingerprint(fingerprint_),
+      listener(listenAt(socketPath)) {}
+
+TileCoordinator::~TileCoordinator() {
+  for (auto& worker : workers) {
+    close(worker.socket);
+  }
+  if (listener >= 0) {
+    close(listener);
+    unlink(socketPath.c_str());
+  }
+}
+
+void TileCoordinator::expectWorker(pid_t pid) {
+  expected.push_back({pid, Clock::now() + GREETING_TIMEOUT});
+  started.push_back(pid);
+}
+
+void TileCoordinator::run(std::deque<Tile> tiles, const FinishFn& finished,
+                          const RenderFn& renderLocally,
+                          const std::function<bool()>& stop) {
+  bool stopping = false;
+  while (true) {
+    stopping = stopping || stop();
+    const bool busy = std::any_of(
+        workers.begin(), workers.end(),
+        [] (const Worker& worker) { return worker.busy; });
+    if ((tiles.empty() || stopping) && !busy) break;
+
+    // With nobody to hand tiles to, get on with them here. Workers may
+    // still connect in between.
+    reapExpected();
+    int timeout = POLL_TIMEOUT;
+    if (!stopping && !tiles.empty() && workers.empty() && expected.empty()) {
+      const Tile tile = tiles.front();
+      tiles.pop_front();
+      std::vector<Colour> pixels;
+      renderLocally(tile, &pixels);
+      finished(tile, pixels);
+      timeout = 0;
+    }
+
+    std::vector<pollfd> fds;
+    if (listener >= 0) {
+      fds.push_back({listener, POLLIN, 0});
+    }
+    for (const auto& worker : workers) {
+      fds.push_back({worker.socket, POLLIN, 0});
+    }
+    if (poll(fds.data(), fds.size(), timeout) < 0 && errno != EINTR) {
+      std::cerr << "Waiting for workers failed: " << std::strerror(errno)
+                << std::endl;
+      break;
+    }
+
+    // Hear from the workers we had before accepting any new ones, so that
+    // the poll results line up
+    const size_t first = listener >= 0 ? 1 : 0;
+    std::vector<bool> gone(workers.size(), false);
+    for (size_t i = 0; i < workers.size(); ++i) {
+      if (fds[first + i].revents != 0) {
+        gone[i] = !receive(&workers[i], finished);
+      }
+    }
+    for (size_t i = workers.size(); i-- > 0;) {
+      if (!gone[i]) continue;
+      auto& worker = workers[i];
+      if (worker.busy) {
+        std::cerr << "Worker " << worker.pid << " went away, handing its "
+                  << "tile to another" << std::endl;
+        tiles.push_front(worker.tile);
+      }
+      close(worker.socket);
+      workers.erase(workers.begin() + i);
+    }
+    dropLate(&tiles);
+    if (listener >= 0 && (fds[0].revents & POLLIN)) {
+      accept();
+    }
+
+    for (size_t i = workers.size(); i-- > 0;) {
+      auto& worker = workers[i];
+      if (!worker.greeted || worker.busy || stopping || tiles.empty()) {
+        continue;
+      }
+      if (!assign(&worker, &tiles)) {
+        close(worker.socket);
+        workers.erase(workers.begin() + i);
+      }
+    }
+  }
+
+  // Let the workers go
+  for (auto& worker : workers) {
+    sendAll(worker.socket, &NO_TILE, sizeof(NO_TILE));
+    close(worker.socket);
+  }
+  workers.clear();
+}
+
+void TileCoordinator::accept() {
+  const int socket = ::accept(listener, nullptr, nullptr);
+  if (socket < 0) return;
+  Worker worker;
+  worker.socket = socket;
+  worker.deadline = Clock::now() + GREETING_TIMEOUT;
+  workers.push_back(worker);
+}
+
+bool TileCoordinator::receive(Worker* worker, const FinishFn& finished) {
+  size_t wanted;
+  if (!worker->greeted) {
+    wanted = sizeof(Hello);
+  }
+  else if (worker->busy) {
+    wanted = resultSize(worker->tile);
+  }
+  else {
+    // Nothing is expected, so this can only be the worker hanging up
+    wanted = 1;
+  }
+
+  const size_t have = worker->buffer.size();
+  worker->buffer.resize(wanted);
+  const ssize_t got =
+      recv(worker->socket, &worker->buffer[have], wanted - have, 0);
+  if (got <= 0) return false;
+  worker->buffer.resize(have + got);
+  if (worker->buffer.size() < wanted) return true;
+
+  if (!worker->greeted) {
+    Hello hello;
+    std::memcpy(&hello, worker->buffer.data(), sizeof(hello));
+    worker->buffer.clear();
+    if (hello.magic != MAGIC || hello.fingerprint != fingerprint) {
+      std::cerr << "Worker " << hello.pid << " is not rendering the same "
+                << "thing, ignoring it" << std::endl;
+      return false;
+    }
+    worker->pid = hello.pid;
+    worker->greeted = true;
+    expected.erase(
+        std::remove_if(expected.begin(), expected.end(),
+                       [worker] (const Expected& pending) {
+                         return pending.pid == worker->pid;
+                       }),
+        expected.end());
+    return true;
+  }
+  if (!worker->busy) return false;
+
+  Tile tile;
+  std::memcpy(&tile, worker->buffer.data(), sizeof(tile));
+  if (std::memcmp(&tile, &worker->tile, sizeof(tile)) != 0) {
+    std::cerr << "Worker " << worker->pid << " sent the wrong tile"
+              << std::endl;
+    return false;
+  }
+  const double* values =
+      reinterpret_cast<const double*>(worker->buffer.data() + sizeof(tile));
+  const size_t count = (tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+  std::vector<Colour> pixels;
+  pixels.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    pixels.emplace_back(values[3 * i], values[3 * i + 1], values[3 * i + 2]);
+  }
+  worker->buffer.clear();
+  worker->busy = false;
+  finished(tile, pixels);
+  return true;
+}
+
+bool TileCoordinator::assign(Worker* worker, std::deque<Tile>* tiles) {
+  worker->tile = tiles->front();
+  if (!sendAll(worker->socket, &worker->tile, sizeof(worker->tile))) {
+    return false;
+  }
+  tiles->pop_front();
+  worker->busy = true;
+  worker->deadline = Clock::now() + TILE_TIMEOUT;
+  return true;
+}
+
+void TileCoordinator::reapExpected() {
+  const auto now = Clock::now();
+  expected.erase(
+      std::remove_if(expected.begin(), expected.end(),
+                     [now] (const Expected& pending) {
+        if (waitpid(pending.pid, nullptr, WNOHANG) != 0) return true;
+        if (now < pending.deadline) return false;
+        std::cerr << "Worker " << pending.pid << " did not say hello in "
+                  << "time, stopping it" << std::endl;
+        kill(pending.pid, SIGKILL);
+        return true;
+      }),
+      expected.end());
+}
+
+void TileCoordinator::dropLate(std::deque<Tile>* tiles) {
+  const auto now = Clock::now();
+  for (size_t i = workers.size(); i-- > 0;) {
+    auto& worker = workers[i];
+    // Idle workers are waiting on us, not the other way round
+    if (worker.greeted && !worker.busy) continue;
+    if (now < worker.deadline) continue;
+    if (worker.busy) {
+      std::cerr << "Worker " << worker.pid << " took too long over its "
+                << "tile, handing it to another" << std::endl;
+      tiles->push_front(worker.tile);
+      if (std::find(started.begin(), started.end(), worker.pid) !=
+          started.end()) {
+        kill(worker.pid, SIGKILL);
+      }
+    }
+    else {
+      std::cerr << "A worker connected but did not say hello in time, "
+                << "dropping it" << std::endl;
+    }
+    close(worker.socket);
+    workers.erase(workers.begin() + i);
+  }
+}
+
+bool runTileWorker(const std::string& socketPath, uint64_t fingerprint,
+                   const TileCoordinator::RenderFn& render,
+                   const std::function<bool()>& stop) {
+  const int socket = connectTo(socketPath);
+  if (socket < 0) return false;
+
+  const Hello hello = {MAGIC, (uint32_t) getpid(), fingerprint};
+  bool ok = sendAll(socket, &hello, sizeof(hello));
+  Tile tile;
+  while (ok && receiveAll(socket, &tile, sizeof(tile))) {
+    if (isEmpty(tile)) {
+      close(socket);
+      return true;
+    }
+
+    std::vector<Colour> pixels;
+    render(tile, &pixels);
+    // A tile cut short is no use to anyone: leave it to be given out again
+    if (stop()) break;
+
+    std::vector<double> values;
+    values.reserve(3 * pixels.size());
+    for (const auto& pixel : pixels) {
+      values.push_back(pixel.R());
+      values.push_back(pixel.G());
+      values.push_back(pixel.B());
+    }
+    ok = sendAll(socket, &tile, sizeof(tile)) &&
+         sendAll(socket, values.data(), values.size() * sizeof(double));
+  }
+  close(socket);
+  return false;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "algebra.hpp"
+#include "TileScheduler.hpp"
+
+// Hands tiles of an image out to worker processes over a Unix domain
+// socket, and collects their finished pixels. Workers are other rt
+// processes with the same scene and options (see runTileWorker), either
+// forked by the renderer or started by hand on the same machine.
+class TileCoordinator {
+ public:
+  // Work out the final pixels of a tile, row by row
+  typedef std::function<void(const Tile&, std::vector<Colour>*)> RenderFn;
+  // Take the pixels of a finished tile
+  typedef std::function<void(const Tile&, const std::vector<Colour>&)>
+      FinishFn;
+
+  // Listen at socketPath. Workers must give the same fingerprint.
+  TileCoordinator(const std::string& socketPath, uint64_t fingerprint);
+  // Stops listening and removes the socket
+  ~TileCoordinator();
+
+  bool isListening() const { return listener >= 0; }
+  const std::string& path() const { return socketPath; }
+
+  // A worker with this pid has been started and should connect soon. If it
+  // has not said hello in time, or takes too long over a tile, it is
+  // killed.
+  void expectWorker(pid_t pid);
+
+  // Hand out tiles until they are all finished, or until stop returns true
+  // and the tiles in hand are back. A worker that goes away, or does not
+  // say hello or finish its tile in time, has its tile given to someone
+  // else. While there are no workers, not even starting up, tiles are
+  // rendered here with renderLocally.
+  void run(std::deque<Tile> tiles, const FinishFn& finished,
+           const RenderFn& renderLocally, const std::function<bool()>& stop);
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Worker {
+    int socket;
+    pid_t pid = 0;
+    bool greeted = false;
+    bool busy = false;
+    Tile tile;
+    // When it must have said hello by, or finished its tile
+    Clock::time_point deadline;
+    // What has arrived of the current message
+    std::vector<char> buffer;
+  };
+
+  // A worker started but not yet greeted, and when it must have by
+  struct Expected {
+    pid_t pid;
+    Clock::time_point deadline;
+  };
+
+  const std::string socketPath;
+  const uint64_t fingerprint;
+  int listener = -1;
+  std::vector<Worker> workers;
+  std::vector<Expected> expected;
+  // Every worker we started, which are ours to kill
+  std::vector<pid_t> started;
+
+  void accept();
+  // Read what there is from worker. Returns false if it has gone away.
+  bool receive(Worker* worker, const FinishFn& finished);
+  // Give worker the next tile, or tell it there are none. Returns false if
+  // it has gone away.
+  bool assign(Worker* worker, std::deque<Tile>* tiles);
+  // Forget expected workers that died before saying hello, and kill those
+  // that are taking too long to
+  void reapExpected();
+  // Drop workers that are past their deadline, putting their tiles back
+  void dropLate(std::deque<Tile>* tiles);
+};
+
+// Connect to the coordinator at socketPath and render the tiles it hands
+// out until there are none left. Returns false if it could not be reached
+// or went away part way.
+bool runTileWorker(const std::string& socketPath, uint64_t fingerprint,
+                   const TileCoordinator::RenderFn& render,
+                   const std::function<bool()>& stop);
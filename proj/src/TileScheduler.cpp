@@ -0,0 +1,94 @@
+#include "TileScheduler.hpp"
+
+#include <algorithm>
+
+namespace {
+
+// Spread the low 16 bits of v out to the even bits
+uint32_t spreadBits(uint32_t v) {
+  v &= 0xffff;
+  v = (v | (v << 8)) & 0x00ff00ff;
+  v = (v | (v << 4)) & 0x0f0f0f0f;
+  v = (v | (v << 2)) & 0x33333333;
+  v = (v | (v << 1)) & 0x55555555;
+  return v;
+}
+
+// Position of (x, y) along the Z-order curve
+uint32_t mortonCode(uint32_t x, uint32_t y) {
+  return spreadBits(x) | (spreadBits(y) << 1);
+}
+
+} // Anonymous
+
+TileScheduler::TileScheduler(
+    uint32_t width, uint32_t height, uint32_t tileSize, uint32_t threadCount,
+    const std::function<bool(const Tile&)>& isDone) {
+  const uint32_t tilesX = (width + tileSize - 1) / tileSize;
+  const uint32_t tilesY = (height + tileSize - 1) / tileSize;
+
+  std::vector<std::pair<uint32_t, Tile>> ordered;
+  for (uint32_t ty = 0; ty < tilesY; ++ty) {
+    for (uint32_t tx = 0; tx < tilesX; ++tx) {
+      Tile tile;
+      tile.x0 = tx * tileSize;
+      tile.y0 = ty * tileSize;
+      tile.x1 = std::min(tile.x0 + tileSize, width);
+      tile.y1 = std::min(tile.y0 + tileSize, height);
+      if (isDone && isDone(tile)) continue;
+      ordered.emplace_back(mortonCode(tx, ty), tile);
+    }
+  }
+  std::sort(ordered.begin(), ordered.end(),
+            [] (const std::pair<uint32_t, Tile>& a,
+                const std::pair<uint32_t, Tile>& b) {
+              return a.first < b.first;
+            });
+
+  // Split the curve into one contiguous run per thread
+  threadCount = std::max(1u, threadCount);
+  for (uint32_t t = 0; t < threadCount; ++t) {
+    queues.emplace_back(new Queue());
+    const size_t begin = ordered.size() * t / threadCount;
+    const size_t end = ordered.size() * (t + 1) / threadCount;
+    for (size_t i = begin; i < end; ++i) {
+      queues[t]->tiles.push_back(ordered[i].second);
+    }
+    queues[t]->initialSize = end - begin;
+  }
+}
+
+bool TileScheduler::next(uint32_t thread, Tile* tile) {
+  auto& queue = *queues[thread];
+  {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.tiles.empty()) {
+      *tile = queue.tiles.front();
+      queue.tiles.pop_front();
+      return true;
+    }
+  }
+  return steal(thread, tile);
+}
+
+bool TileScheduler::steal(uint32_t thread, Tile* tile) {
+  // Try the other threads in turn, starting with the next one along
+  for (size_t i = 1; i < queues.size(); ++i) {
+    auto& victim = *queues[(thread + i) % queues.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tiles.empty()) {
+      // The back is furthest from where the victim is working
+      *tile = victim.tiles.back();
+      victim.tiles.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
+
+double TileScheduler::progress(uint32_t thread) {
+  auto& queue = *queues[thread];
+  std::lock_guard<std::mutex> lock(queue.mutex);
+  if (queue.initialSize == 0) return 1;
+  return 1 - queue.tiles.size() / (double) queue.initialSize;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// A rectangle of pixels, [x0, x1) x [y0, y1)
+struct Tile {
+  uint32_t x0, y0, x1, y1;
+};
+
+// Hands out the tiles of an image to a fixed set of threads. Tiles are laid
+// out along a Z-order curve so that consecutive tiles are close together,
+// and each thread starts with its own contiguous run of them. A thread that
+// runs out takes tiles from the far end of another thread's run.
+class TileScheduler {
+ public:
+  // Tiles for which isDone returns true, if given, are left out
+  TileScheduler(uint32_t width, uint32_t height,
+                uint32_t tileSize, uint32_t threadCount,
+                const std::function<bool(const Tile&)>& isDone = nullptr);
+
+  // Get the next tile for thread (in [0, threadCount)).
+  // Returns false once every tile has been handed out.
+  bool next(uint32_t thread, Tile* tile);
+
+  // How much of the run thread started with has been handed out, in [0, 1]
+  double progress(uint32_t thread);
+
+ private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Tile> tiles;
+    size_t initialSize = 0;
+  };
+
+  // Mutexes cannot be moved, so the queues are held by pointer
+  std::vector<std::unique_ptr<Queue>> queues;
+
+  bool steal(uint32_t thread, Tile* tile);
+};
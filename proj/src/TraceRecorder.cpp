@@ -0,0 +1,170 @@
+#include "TraceRecorder.hpp"
+
+#include <unistd.h>
+
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace trace {
+
+std::atomic<bool> recording(false);
+
+namespace {
+
+struct Event {
+  std::string name;
+  // In nanoseconds since recording started
+  int64_t start;
+  int64_t duration;
+  int32_t x, y;
+};
+
+// One thread's events. Only that thread touches it until finish.
+struct Buffer {
+  uint32_t row;
+  std::vector<Event> events;
+};
+
+std::mutex mutex;
+Clock::time_point epoch;
+// Counts starts, so threads can tell their buffer is from an earlier one
+std::atomic<uint32_t> session(0);
+std::vector<std::unique_ptr<Buffer>> buffers;
+// Row names, by row number
+std::vector<std::string> rows;
+
+struct ThreadState {
+  Buffer* buffer;
+  uint32_t session;
+};
+thread_local ThreadState current = {nullptr, 0};
+
+// The row called name, added if there is none. Call with mutex held.
+uint32_t rowFor(const std::string& name) {
+  for (uint32_t i = 0; i < rows.size(); ++i) {
+    if (rows[i] == name) return i;
+  }
+  rows.push_back(name);
+  return rows.size() - 1;
+}
+
+bool haveBuffer() {
+  return current.buffer && current.session == session;
+}
+
+// A buffer for this thread in the current recording, in the row called
+// name, or a row of its own if name is empty. Call with mutex held.
+Buffer* newBuffer(const std::string& name) {
+  buffers.emplace_back(new Buffer);
+  Buffer* buffer = buffers.back().get();
+  buffer->row = rowFor(
+      name.empty() ? "Thread " + std::to_string(buffers.size()) : name);
+  buffer->events.reserve(1024);
+  current = {buffer, session};
+  return buffer;
+}
+
+void writeString(std::ostream& out, const std::string& s) {
+  out << '"';
+  for (const char c : s) {
+    if (c == '"' || c == '\\') out << '\\';
+    out << c;
+  }
+  out << '"';
+}
+
+} // Anonymous
+
+void start() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    session += 1;
+    buffers.clear();
+    rows.clear();
+    epoch = Clock::now();
+  }
+  recording = true;
+  nameThread("Main");
+}
+
+bool finish(const std::string& path) {
+  recording = false;
+  std::lock_guard<std::mutex> lock(mutex);
+  std::ofstream out(path);
+  const auto pid = getpid();
+  out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [" << std::endl;
+  for (uint32_t row = 0; row < rows.size(); ++row) {
+    out << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << pid
+        << ", \"tid\": " << row << ", \"args\": {\"name\": ";
+    writeString(out, rows[row]);
+    out << "}}," << std::endl;
+    out << "{\"name\": \"thread_sort_index\", \"ph\": \"M\", \"pid\": " << pid
+        << ", \"tid\": " << row << ", \"args\": {\"sort_index\": " << row
+        << "}}";
+    out << (row + 1 < rows.size() ? "," : "") << std::endl;
+  }
+  for (const auto& buffer : buffers) {
+    for (const auto& event : buffer->events) {
+      out << ",{\"name\": ";
+      writeString(out, event.name);
+      out << ", \"ph\": \"X\", \"pid\": " << pid << ", \"tid\": "
+          << buffer->row << ", \"ts\": " << event.start / 1000.0
+          << ", \"dur\": " << event.duration / 1000.0;
+      if (event.x >= 0) {
+        out << ", \"args\": {\"x\": " << event.x << ", \"y\": " << event.y
+            << "}";
+      }
+      out << "}" << std::endl;
+    }
+  }
+  out << "]}" << std::endl;
+
+  size_t events = 0;
+  for (const auto& buffer : buffers) {
+    events += buffer->events.size();
+  }
+  buffers.clear();
+  rows.clear();
+  if (!out) {
+    std::cerr << "Could not write trace " << path << std::endl;
+    return false;
+  }
+  std::cerr << "Wrote " << events << " trace events to " << path
+            << std::endl;
+  return true;
+}
+
+void nameThread(const std::string& name) {
+  if (!isRecording()) return;
+  std::lock_guard<std::mutex> lock(mutex);
+  if (haveBuffer()) {
+    current.buffer->row = rowFor(name);
+  }
+  else {
+    newBuffer(name);
+  }
+}
+
+void record(const std::string& name, Clock::time_point start,
+            int32_t x, int32_t y) {
+  if (!isRecording()) return;
+  Buffer* buffer = current.buffer;
+  if (!haveBuffer()) {
+    std::lock_guard<std::mutex> lock(mutex);
+    buffer = newBuffer("");
+  }
+  const auto now = Clock::now();
+  buffer->events.push_back(Event{
+      name,
+      std::chrono::duration_cast<std::chrono::nanoseconds>(start - epoch)
+          .count(),
+      std::chrono::duration_cast<std::chrono::nanoseconds>(now - start)
+          .count(),
+      x, y});
+}
+
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Records what a render spends its time on as a timeline, and writes it as
+// Chrome trace events, to open in chrome://tracing or ui.perfetto.dev.
+//
+// Each thread records into a buffer of its own, so recording takes no locks
+// past a thread's first event. Threads get a row each by name, so the
+// threads of successive passes that share a name share a row. While not
+// recording, everything here is a check of one flag.
+namespace trace {
+
+typedef std::chrono::steady_clock Clock;
+
+extern std::atomic<bool> recording;
+
+inline bool isRecording() {
+  return recording.load(std::memory_order_relaxed);
+}
+
+// Start recording, naming the calling thread Main. Anything recorded
+// before is dropped.
+void start();
+// Write what was recorded to path and stop recording. Every thread that
+// recorded must be done. Returns false, having said why, if it could not
+// be written.
+bool finish(const std::string& path);
+
+// Put this thread's events in the row called name
+void nameThread(const std::string& name);
+
+// Record name as running from start until now. x and y, if not negative,
+// say which pixels it was about.
+void record(const std::string& name, Clock::time_point start,
+            int32_t x = -1, int32_t y = -1);
+
+// Records name as running for as long as it is in scope
+class Scope {
+ public:
+  explicit Scope(const char* name_, int32_t x_ = -1, int32_t y_ = -1)
+      : name(isRecording() ? name_ : nullptr), x(x_), y(y_) {
+    if (name) start = Clock::now();
+  }
+  ~Scope() {
+    if (name) record(name, start, x, y);
+  }
+
+  Scope(const Scope&) = delete;
+  Scope& operator=(const Scope&) = delete;
+
+ private:
+  const char* const name;
+  const int32_t x, y;
+  Clock::time_point start;
+};
+
+}
@@ -1,337 +1,466 @@
 #include "UniformGrid.hpp"
 
+#include <atomic>
+#include <chrono>
 #include <cmath>
-#include <ctime>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <thread>
 
+#include <sys/resource.h>
+
+#include "AovImages.hpp"
 #include "HitRecord.hpp"
-#include "primitives/Cube.hpp"
-#include "xform.hpp"
+#include "RenderCounters.hpp"
+#include "TraceRecorder.hpp"
 
 namespace {
 
-// Check if p is between planes with vectors n1 and n2
-bool betweenPlanes(const Vector3D& n1, const Point3D& p1,
-                   const Vector3D& n2, const Point3D& p2,
-                   const Point3D& p) {
-  return (n1.dot(p - p1) * n2.dot(p - p2)) <= 0;
+// Per-thread mailboxes, holding the id of the last ray that tested each
+// item. An item spanning many cells is then only tested once per ray.
+thread_local std::vector<uint64_t> mailbox;
+thread_local uint64_t lastRayId = 0;
+
+// Cells holding at least this many items get a sub-grid, if there are
+// levels to spare
+const uint32_t SUB_GRID_THRESHOLD = 16;
+
+// Most memory the process has used so far
+long peakMemoryKiB() {
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
 }
 
 }
 
 UniformGrid::UniformGrid(const std::list<Model>& models,
                          const Point3D& minPoint, const Point3D& maxPoint,
-                         uint32_t sizeFactor) {
-  sideLength = (int) std::cbrt((double) sizeFactor * models.size());
+                         uint32_t sizeFactor, bool splitMeshes,
+                         uint32_t levels, uint32_t threadCount) {
+  for (const auto& model : models) {
+    const int faces = splitMeshes ? model.faceCount() : 0;
+    if (faces == 0) {
+      items.emplace_back(&model, -1);
+    }
+    for (int face = 0; face < faces; ++face) {
+      items.emplace_back(&model, face);
+    }
+  }
 
   // Add some padding to avoid edge points
   double PADDING = 0.1;
-  double minCoord = std::min({minPoint[0], minPoint[1], minPoint[2]}) - PADDING;
-  double maxCoord = std::max({maxPoint[0], maxPoint[1], maxPoint[2]}) + PADDING;
+  bounds = BoundingBox(minPoint, maxPoint);
+  bounds.pad(PADDING);
+  fitCells(items.size(), sizeFactor);
+
 
-  startPoint = Point3D(minCoord, minCoord, minCoord);
+  std::cerr << "Populating the cells: "
+            << cellCounts.x * cellCounts.y * cellCounts.z << std::endl;
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<uint32_t> members(items.size());
+  for (uint32_t i = 0; i < items.size(); ++i) {
+    members[i] = i;
+  }
+  populateCells(items, members, threadCount);
+  buildSubGrids(items, sizeFactor, levels, threadCount);
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  std::cerr << "Populating time: "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(
+                   elapsed).count()
+            << " ms on " << threadCount << " threads" << std::endl;
+  std::cerr << "Grid is " << cellCounts.x << "x" << cellCounts.y << "x"
+            << cellCounts.z << " cells with " << subGridCount
+            << " sub-grids, using " << memoryUsage() / 1024
+            << " KiB (peak RSS " << peakMemoryKiB() << " KiB)" << std::endl;
+}
 
-  double distance = maxCoord - minCoord;
-  cellSize = distance / sideLength;
-  cellSizeScaleMatrix = scaleMatrix(cellSize, cellSize, cellSize);
-  gridSizeScaleMatrix = scaleMatrix(distance, distance, distance);
+UniformGrid::UniformGrid(const std::vector<GridItem>& allItems,
+                         const std::vector<uint32_t>& members,
+                         const BoundingBox& box,
+                         uint32_t sizeFactor, uint32_t levels) {
+  bounds = box;
+  fitCells(members.size(), sizeFactor);
+  populateCells(allItems, members, 1);
+  buildSubGrids(allItems, sizeFactor, levels, 1);
+}
 
-  cells.resize(sideLength * sideLength * sideLength);
+void UniformGrid::fitCells(size_t itemCount, uint32_t sizeFactor) {
+  startPoint = bounds.min;
 
-  std::clock_t start = std::clock();
-  // Now we must populate the cells
-  populateCells(models);
-  std::cerr << "Populating time: "
-            << (std::clock() - start) / (double)(CLOCKS_PER_SEC / 1000)
-            << " ms" << std::endl;
+  // Aim for sizeFactor cells per item, shaped like the space: the cells per
+  // unit length k is chosen so that (kx)(ky)(kz) is about that many
+  const auto extent = bounds.size();
+  const double volume = extent[0] * extent[1] * extent[2];
+  const double perUnit = std::cbrt(sizeFactor * itemCount / volume);
+  for (int i = 0; i < 3; ++i) {
+    cellCounts[i] = std::max(1, (int) std::round(extent[i] * perUnit));
+    cellSize[i] = extent[i] / cellCounts[i];
+  }
 }
 
 int UniformGrid::indexFor(const UniformGrid::CellCoord& coord) const {
-  return coord.x * sideLength*sideLength + coord.y * sideLength + coord.z;
+  return (coord.x * cellCounts.y + coord.y) * cellCounts.z + coord.z;
 }
 
 UniformGrid::CellCoord UniformGrid::coordAt(const Point3D& pt) const {
   // Adjust so that the minimum will be at (0, 0, 0)
   Point3D p(pt[0] - startPoint[0], pt[1] - startPoint[1], pt[2] - startPoint[2]);
   auto c = CellCoord(
-    (int) (p[0] / cellSize),
-    (int) (p[1] / cellSize),
-    (int) (p[2] / cellSize)
+    (int) (p[0] / cellSize[0]),
+    (int) (p[1] / cellSize[1]),
+    (int) (p[2] / cellSize[2])
   );
   for (int i = 0; i < 3; ++i) {
-    if (c[i] >= sideLength) c[i] -= 1;
+    if (c[i] >= cellCounts[i]) c[i] -= 1;
   }
   return c;
 }
 
 UniformGrid::CellCoord UniformGrid::coordAt(int index) const {
-  int z = index % sideLength;
-  index /= sideLength;
-  int y = index % sideLength;
-  index /= sideLength;
+  int z = index % cellCounts.z;
+  index /= cellCounts.z;
+  int y = index % cellCounts.y;
+  index /= cellCounts.y;
   int x = index;
   return CellCoord(x, y, z);
 }
 
-void UniformGrid::populateCells(const std::list<Model>& models) {
-  // Populate the cells with the models
-  std::cerr << "Populating the cells: " << cells.size() << std::endl;
-  for (const auto& model : models) {
-    auto bbox = model.getBoundingBox();
-    Point3D min = bbox.front();
-    Point3D max = bbox.front();
-    getMinAndMax(bbox, &min, &max);
-    auto minCoord = coordAt(min);
-    auto maxCoord = coordAt(max);
-    for (size_t x = minCoord[0]; x <= maxCoord[0]; ++x) {
-      for (size_t y = minCoord[1]; y <= maxCoord[1]; ++y) {
-        for (size_t z = minCoord[2]; z <= maxCoord[2]; ++z) {
-          UniformGrid::CellCoord coord(x, y, z);
-          if (intersectsCell(model, coord)) {
-            cells[indexFor(coord)].models.push_back(&model);
+void UniformGrid::populateCells(const std::vector<GridItem>& allItems,
+                                const std::vector<uint32_t>& members,
+                                uint32_t threadCount) {
+  // Work out the range of cells each item could touch up front, along with
+  // the corners of each face, rather than once per thread
+  struct ItemShape {
+    CellCoord minCoord = CellCoord(0, 0, 0);
+    CellCoord maxCoord = CellCoord(0, 0, 0);
+    std::vector<Point3D> face;
+  };
+  std::vector<ItemShape> shapes(members.size());
+  for (uint32_t m = 0; m < members.size(); ++m) {
+    const auto& item = allItems[members[m]];
+    auto& shape = shapes[m];
+    BoundingBox box;
+    if (item.face < 0) {
+      box = item.model->getBounds();
+    }
+    else {
+      shape.face = item.model->getFaceVertices(item.face);
+      box = BoundingBox(shape.face);
+    }
+    // Sub-grids only cover part of an item, so clamp to the grid
+    shape.minCoord = coordAt(box.min);
+    shape.maxCoord = coordAt(box.max);
+    for (int i = 0; i < 3; ++i) {
+      shape.minCoord[i] = std::max(shape.minCoord[i], 0);
+      shape.maxCoord[i] = std::min(shape.maxCoord[i], cellCounts[i] - 1);
+    }
+  }
+
+  // The first pass finds every (cell, item) pair and counts the items in
+  // each cell. Thread t takes every column (x, y) with
+  // (x * cy + y) % threadCount == t, so only it touches those counts.
+  threadCount = std::max(1u, threadCount);
+  const size_t cellCount = cellCounts.x * cellCounts.y * cellCounts.z;
+  std::vector<uint32_t> counts(cellCount, 0);
+  std::vector<std::vector<std::pair<uint32_t, uint32_t>>> pairs(threadCount);
+  auto find = [&, this] (uint32_t thread) {
+    trace::Scope scope("Find cells");
+    auto& found = pairs[thread];
+    for (uint32_t m = 0; m < members.size(); ++m) {
+      const auto i = members[m];
+      const auto& item = allItems[i];
+      const auto& shape = shapes[m];
+      for (int x = shape.minCoord.x; x <= shape.maxCoord.x; ++x) {
+        for (int y = shape.minCoord.y; y <= shape.maxCoord.y; ++y) {
+          if ((uint32_t) (x * cellCounts.y + y) % threadCount != thread) {
+            continue;
+          }
+          for (int z = shape.minCoord.z; z <= shape.maxCoord.z; ++z) {
+            const CellCoord coord(x, y, z);
+            const auto box = cellBounds(coord);
+            const bool overlaps = item.face < 0
+                ? item.model->overlaps(box)
+                : box.overlapsPolygon(shape.face);
+            if (overlaps) {
+              const uint32_t cell = indexFor(coord);
+              found.emplace_back(cell, i);
+              counts[cell] += 1;
+            }
           }
         }
       }
     }
-  }
-  std::cerr << "Done populating cells" << std::endl;
-}
-
-Point3D UniformGrid::pointAt(const UniformGrid::CellCoord& coord) const {
-  return startPoint + Vector3D(cellSize * coord.x,
-                             cellSize * coord.y,
-                             cellSize * coord.z);
-}
-
-bool UniformGrid::intersectsCell(const Model& model, const CellCoord& coord) {
-  // Left side
-  // Bottom left point
-  Point3D p0 = pointAt(coord);
-  Point3D p1(p0[0], p0[1] + cellSize, p0[2]);
-  Point3D p2(p0[0], p0[1] + cellSize, p0[2] + cellSize);
-  Point3D p3(p0[0], p0[1], p0[2] + cellSize);
-
-  // Right side
-  Point3D p4(p0[0] + cellSize, p0[1], p0[2]);
-  Point3D p5(p0[0] + cellSize, p0[1] + cellSize, p0[2]);
-  Point3D p6(p0[0] + cellSize, p0[1] + cellSize, p0[2] + cellSize);
-  Point3D p7(p0[0] + cellSize, p0[1], p0[2] + cellSize);
-
-  const std::vector<Point3D> pts = {p0, p1, p2, p3, p4, p5, p6, p7};
-
-  auto cellMat = translationMatrix(p0[0], p0[1], p0[2]) * cellSizeScaleMatrix;
-  // But we need the inverse of course
-  cellMat = cellMat.invert();
-
-  // Check if a pt is in the cell
-  auto inCell = [&] (const Point3D& pt) -> bool {
-    return p0[0] <= pt[0] && pt[0] <= (p0[0] + cellSize) &&
-           p0[1] <= pt[1] && pt[1] <= (p0[1] + cellSize) &&
-           p0[2] <= pt[2] && pt[2] <= (p0[2] + cellSize);
   };
 
-  // First, we need to get the 8 points of the bounding box
-  auto bbox = model.getBoundingBox();
-
-  auto inBoundingBox = [&bbox] (const Point3D& pt) -> bool {
-    // We are in the box if we are in between all the opposite parallel planes
-    const auto c1 = bbox[0]; // Bottom back left corner
-    const auto v1a = bbox[1] - c1; // Bottom back left to bottom back right
-    const auto v1b = bbox[3] - c1; // Bottom back left to top back left
-    const auto v1c = bbox[4] - c1; // Bottom back left to bottom front left
-    const auto n1 = v1a.cross(v1b); // Back face
-    const auto n2 = v1b.cross(v1c); // Left face
-    const auto n3 = v1c.cross(v1a); // Bottom face
-
-    const auto c2 = bbox[6]; // Top front right corner
-    const auto v2a = bbox[5] - c2; // Top front right to bottom front right
-    const auto v2b = bbox[7] - c2; // Top front right to top front left
-    const auto v2c = bbox[2] - c2; // Top front right to top back right
-    // We want this to be opposite sign (i.e. not pointing inwards)
-    // so we do the opposite cross as above
-    const auto n4 = v2b.cross(v2a); // Front face
-    const auto n5 = v2c.cross(v2b); // Top face
-    const auto n6 = v2a.cross(v2c); // Right face
-
-    return betweenPlanes(n1, c1, n4, c2, pt) &&
-           betweenPlanes(n2, c1, n6, c2, pt) &&
-           betweenPlanes(n3, c1, n5, c2, pt);
+  // The second pass copies each thread's pairs into place. Every thread
+  // found its items in order, so each cell lists its items in the same
+  // order as a serial build would.
+  std::vector<uint32_t> next;
+  auto fill = [this, &pairs, &next] (uint32_t thread) {
+    trace::Scope scope("Fill cells");
+    for (const auto& pair : pairs[thread]) {
+      cellItems[next[pair.first]++] = pair.second;
+    }
+    pairs[thread].clear();
+    pairs[thread].shrink_to_fit();
   };
 
-  // A corner of the bbox being inside the cell implies an intersection
-  // between the bbox and the cell.
-  for (const auto& pt : bbox) {
-    if (inCell(pt)) {
-      return true;
+  auto runThreads = [threadCount] (const std::function<void(uint32_t)>& f) {
+    std::vector<std::thread> threads;
+    for (uint32_t t = 1; t < threadCount; ++t) {
+      threads.emplace_back([&f, t] {
+        if (trace::isRecording()) {
+          trace::nameThread("Grid " + std::to_string(t));
+        }
+        f(t);
+      });
     }
-  }
-
-  // Similarly, a corner of cell inside bbox implies intersection
-  for (const auto& pt : pts) {
-    if (inBoundingBox(pt)) {
-      return true;
+    f(0);
+    for (auto& thread : threads) {
+      thread.join();
     }
+  };
+
+  runThreads(find);
+
+  cellOffsets.resize(cellCount + 1);
+  cellOffsets[0] = 0;
+  for (size_t c = 0; c < cellCount; ++c) {
+    cellOffsets[c + 1] = cellOffsets[c] + counts[c];
   }
+  cellItems.resize(cellOffsets[cellCount]);
+  next.assign(cellOffsets.begin(), cellOffsets.end() - 1);
+
+  runThreads(fill);
+}
+
+void UniformGrid::buildSubGrids(const std::vector<GridItem>& allItems,
+                                uint32_t sizeFactor, uint32_t levels,
+                                uint32_t threadCount) {
+  if (levels <= 1) return;
 
-  // Check if any of the 12 lines from bbox intersect this cell
-  HitRecord hr;
-  for (size_t i = 0; i < 8; ++i) {
-    // This is the vector of one edge
-    Vector3D v = bbox[(i % 4 == 0) ? i + 3 : i - 1] - bbox[i];
-    Ray ray(bbox[i] - v, bbox[i]);
-    if (utilityCube.intersects(ray, &hr, cellMat) && 1 <= hr.t && hr.t <= 2) {
-      // This edge of the bounding box intersects our cell cube.
-      return true;
+  std::vector<uint32_t> crowded;
+  const size_t cellCount = cellOffsets.size() - 1;
+  for (uint32_t c = 0; c < cellCount; ++c) {
+    if (cellOffsets[c + 1] - cellOffsets[c] >= SUB_GRID_THRESHOLD) {
+      crowded.push_back(c);
     }
   }
-  for (size_t i = 0; i < 4; ++i) {
-    Vector3D v = bbox[i + 4] - bbox[i];
-    Ray ray(bbox[i] - v, bbox[i]);
-    if (utilityCube.intersects(ray, &hr, cellMat) && 1 <= hr.t && hr.t <= 2) {
-      // This edge of the bounding box intersects our cell cube.
-      return true;
+  if (crowded.empty()) return;
+  subGrids.resize(cellCount);
+
+  // Sub-grids take very different amounts of work, so threads take the
+  // next crowded cell as they finish rather than a fixed share
+  std::atomic<size_t> next(0);
+  std::atomic<size_t> built(0);
+  auto build = [&, this] (uint32_t thread) {
+    if (thread > 0 && trace::isRecording()) {
+      trace::nameThread("Grid " + std::to_string(thread));
     }
-  }
-
-  // Now check if any of the 12 lines from this cell intersect the model
-  for (size_t i = 0; i < pts.size(); ++i) {
-    Vector3D v = pts[(i % 4 == 0) ? i + 3 : i - 1] - pts[i];
-    // Note: We are doing pts[i] - v and checking for t between 1 and 2.
-    // This is equivalent to checking between 0 and 1 without doing the
-    // subtraction, *but* we have an epsilon check in the intersects code.
-    // For this case, we do *not* want to bother with epsilon check, so we
-    // will check from 1 to 2 to avoid it.
-    if (model.intersects(Ray(pts[i] - v, pts[i]), &hr)) {
-      if (1 <= hr.t && hr.t <= 2) {
-        return true;
-      }
+    trace::Scope scope("Build sub-grids");
+    size_t n;
+    while ((n = next.fetch_add(1)) < crowded.size()) {
+      const auto c = crowded[n];
+      const std::vector<uint32_t> members(
+          cellItems.begin() + cellOffsets[c],
+          cellItems.begin() + cellOffsets[c + 1]);
+      subGrids[c].reset(new UniformGrid(
+          allItems, members, cellBounds(coordAt((int) c)),
+          sizeFactor, levels - 1));
+      built += 1 + subGrids[c]->subGridCount;
     }
-  }
+  };
 
-  // Now we have to check the struts between the two sides
-  for (size_t i = 0; i < 4; ++i) {
-    Vector3D v = pts[i + 4] - pts[i];
-    if (model.intersects(Ray(pts[i] - v, pts[i]), &hr)) {
-      if (1 <= hr.t && hr.t <= 2) {
-        return true;
-      }
-    }
+  std::vector<std::thread> threads;
+  for (uint32_t t = 1; t < threadCount; ++t) {
+    threads.emplace_back(build, t);
+  }
+  build(0);
+  for (auto& thread : threads) {
+    thread.join();
   }
+  subGridCount = built;
+}
 
-  return false;
+Point3D UniformGrid::pointAt(const UniformGrid::CellCoord& coord) const {
+  return startPoint + Vector3D(cellSize[0] * coord.x,
+                               cellSize[1] * coord.y,
+                               cellSize[2] * coord.z);
 }
 
-std::set<const Model*> UniformGrid::getModels(const Ray& ray) const {
-  std::set<const Model*> models;
+BoundingBox UniformGrid::cellBounds(const CellCoord& coord) const {
+  const auto p0 = pointAt(coord);
+  return BoundingBox(p0, p0 + cellSize);
+}
 
-  Point3D nextT(0, 0, 0);
+bool UniformGrid::intersects(const Ray& ray, HitRecord* hitRecord) const {
+  if (mailbox.size() < items.size()) {
+    mailbox.resize(items.size(), 0);
+  }
+  const auto rayId = ++lastRayId;
 
-  // The point *within* the grid where the ray first intersected it
-  Point3D rayStartPoint(0, 0, 0);
+  uint64_t visited = 0;
+  const bool hit = intersectsCells(items, ray, hitRecord, rayId, &visited);
+  counters::countGridWalk(visited);
+  aov::countCells(visited);
+  return hit;
+}
 
-  if (!inGrid(ray.start)) {
-    const auto& sp = startPoint;
-    // Not in the grid: We will use a cube the sz of whole grid to find
-    // the point of entry into the grid
-    auto gridCubeInverse = (translationMatrix(sp[0], sp[0], sp[0]) *
-                           gridSizeScaleMatrix).invert();
-    HitRecord hr;
-    if (!utilityCube.intersects(ray, &hr, gridCubeInverse)) {
-      // Does not intersect the grid even
-      return models;
+bool UniformGrid::intersectsCells(const std::vector<GridItem>& allItems,
+                                  const Ray& ray, HitRecord* hitRecord,
+                                  uint64_t rayId, uint64_t* visited) const {
+  bool hit = false;
+  walk(ray, [&] (int cell, double tExit) {
+    *visited += 1;
+    if (!subGrids.empty() && subGrids[cell]) {
+      // The sub-grid walks the same ray, clipped to this cell
+      if (subGrids[cell]->intersectsCells(
+            allItems, ray, hitRecord, rayId, visited)) {
+        hit = true;
+      }
     }
-    nextT[0] = hr.t;
-    nextT[1] = hr.t;
-    nextT[2] = hr.t;
-    rayStartPoint = ray.at(hr.t);
+    else {
+      for (auto k = cellOffsets[cell]; k < cellOffsets[cell + 1]; ++k) {
+        const auto i = cellItems[k];
+        if (mailbox[i] == rayId) continue;
+        mailbox[i] = rayId;
+        if (allItems[i].intersects(ray, hitRecord)) {
+          hit = true;
+        }
+      }
+    }
+    // A hit inside this cell beats anything in the cells after it
+    return hitRecord->t >= 0 && hitRecord->t <= tExit;
+  });
+  return hit;
+}
+
+bool UniformGrid::occludes(const Ray& ray, double tMin, double tMax) const {
+  if (mailbox.size() < items.size()) {
+    mailbox.resize(items.size(), 0);
   }
-  else {
-    rayStartPoint = ray.start;
+  const auto rayId = ++lastRayId;
+
+  uint64_t visited = 0;
+  const bool blocked =
+      occludesCells(items, ray, tMin, tMax, rayId, &visited);
+  counters::countGridWalk(visited);
+  aov::countCells(visited);
+  return blocked;
+}
+
+bool UniformGrid::occludesCells(const std::vector<GridItem>& allItems,
+                                const Ray& ray, double tMin, double tMax,
+                                uint64_t rayId, uint64_t* visited) const {
+  bool blocked = false;
+  walk(ray, [&] (int cell, double tExit) {
+    *visited += 1;
+    if (!subGrids.empty() && subGrids[cell]) {
+      blocked = subGrids[cell]->occludesCells(
+          allItems, ray, tMin, tMax, rayId, visited);
+    }
+    else {
+      for (auto k = cellOffsets[cell]; k < cellOffsets[cell + 1]; ++k) {
+        const auto i = cellItems[k];
+        if (mailbox[i] == rayId) continue;
+        mailbox[i] = rayId;
+        if (allItems[i].occludes(ray, tMin, tMax)) {
+          blocked = true;
+          break;
+        }
+      }
+    }
+    // Cells after this one start beyond tMax
+    return blocked || tExit >= tMax;
+  });
+  return blocked;
+}
+
+template <typename Visitor>
+void UniformGrid::walk(const Ray& ray, Visitor visit) const {
+  const double INF = std::numeric_limits<double>::infinity();
+  const auto invDir = inverseDirection(ray.dir);
+
+  // Find where the ray enters and leaves the grid
+  double tEnter = 0;
+  double tLeave = INF;
+  if (!bounds.clip(ray, invDir, &tEnter, &tLeave)) {
+    return;
   }
 
   // Place in the grid we are currently stepping through
-  CellCoord gridCoord = coordAt(rayStartPoint);
+  CellCoord gridCoord = coordAt(ray.at(tEnter));
 
-  Vector3D dir(
-      std::abs(ray.dir[0]), std::abs(ray.dir[1]), std::abs(ray.dir[2]));
-
-  // These values are in units of t: how far we must go to travel a whole cell
-  Vector3D dt(
-    isZero(dir[0]) ? 0 : cellSize / dir[0],
-    isZero(dir[1]) ? 0 : cellSize / dir[1],
-    isZero(dir[2]) ? 0 : cellSize / dir[2]
-  );
-  {
-    // The bottom left corner of the cell we are starting in
-    Point3D gsp = pointAt(gridCoord); // "Grid start point"
-
-    // Determine how far, in units of t, we have to go in any direction
-    // to reach the next cell
-    // If we are going "forwards" in a coordinate then we need to travel to
-    // gsp + cellSize. If we are going "backwards" in a coordinate then we need
-    // to travel to only gsp.
-    for (int i = 0; i < 3; ++i) {
-      if (isZero(dir[i])) {
-        nextT[i] = -1;
-        continue;
-      }
-      if (ray.dir[i] < 0) {
-        nextT[i] += (rayStartPoint[i] - gsp[i]) / dir[i];
-      }
-      else {
-        nextT[i] += (gsp[i] + cellSize - rayStartPoint[i]) / dir[i];
-      }
+  // Which direction in the grid to move along each axis, the t at which we
+  // cross into the next cell along it, and how much t a whole cell takes
+  CellCoord incs(0, 0, 0);
+  double nextT[3];
+  double dt[3];
+  for (int i = 0; i < 3; ++i) {
+    // Rounding can put the entry point just outside the grid
+    gridCoord[i] = std::min(std::max(gridCoord[i], 0), cellCounts[i] - 1);
+
+    const double cellStart = startPoint[i] + gridCoord[i] * cellSize[i];
+    if (ray.dir[i] > 0) {
+      incs[i] = 1;
+      nextT[i] = (cellStart + cellSize[i] - ray.start[i]) * invDir[i];
+      dt[i] = cellSize[i] * invDir[i];
+    }
+    else if (ray.dir[i] < 0) {
+      incs[i] = -1;
+      nextT[i] = (cellStart - ray.start[i]) * invDir[i];
+      dt[i] = -cellSize[i] * invDir[i];
+    }
+    else {
+      nextT[i] = INF;
+      dt[i] = INF;
     }
   }
 
-  // Which direction in the grid to move when we hit a "next" value
-  CellCoord incs(
-    (ray.dir[0] > 0) ? 1 : -1,
-    (ray.dir[1] > 0) ? 1 : -1,
-    (ray.dir[2] > 0) ? 1 : -1
-  );
-
-  // Check if a coord is still valid
-  auto coordOk = [&] (int coord) -> bool {
-    return 0 <= coord && coord < sideLength;
-  };
-  auto smaller = [] (double a, double b) -> bool {
-    return (b < 0) || a <= b;
-  };
+  while (true) {
+    // The next cell boundary we cross
+    int axis = 0;
+    if (nextT[1] < nextT[axis]) axis = 1;
+    if (nextT[2] < nextT[axis]) axis = 2;
 
-  while (coordOk(gridCoord.x) && coordOk(gridCoord.y) && coordOk(gridCoord.z)) {
-    for (const Model* model : cells[indexFor(gridCoord)].models) {
-      models.insert(model);
+    if (visit(indexFor(gridCoord), std::min(nextT[axis], tLeave))) {
+      return;
+    }
+    if (nextT[axis] >= tLeave) {
+      return;
     }
 
-    for (int i = 0; i < 3; ++i) {
-      if (nextT[i] < 0) continue;
-      const auto a = nextT[(i + 1) % 3];
-      const auto b = nextT[(i + 2) % 3];
-      if (smaller(nextT[i], a) && smaller(nextT[i], b)) {
-        nextT[i] += dt[i];
-        gridCoord[i] += incs[i];
-        break;
-      }
+    gridCoord[axis] += incs[axis];
+    if (gridCoord[axis] < 0 || gridCoord[axis] >= cellCounts[axis]) {
+      return;
     }
+    nextT[axis] += dt[axis];
   }
+}
 
-  return models;
+bool UniformGrid::GridItem::intersects(
+    const Ray& ray, HitRecord* hitRecord) const {
+  return face < 0 ? model->intersects(ray, hitRecord)
+                  : model->intersectsFace(face, ray, hitRecord);
 }
 
-bool UniformGrid::inGrid(const Point3D& pt) const {
-  const double d = cellSize * sideLength;
-  return startPoint[0] <= pt[0] && pt[0] <= startPoint[0] + d &&
-         startPoint[1] <= pt[1] && pt[1] <= startPoint[1] + d &&
-         startPoint[2] <= pt[2] && pt[2] <= startPoint[2] + d;
+bool UniformGrid::GridItem::occludes(
+    const Ray& ray, double tMin, double tMax) const {
+  return face < 0 ? model->occludes(ray, tMin, tMax)
+                  : model->occludesFace(face, ray, tMin, tMax);
 }
 
-void UniformGrid::getMinAndMax(const std::vector<Point3D>& pts,
-                               Point3D* min, Point3D* max) const {
-  for (const auto& pt : pts) {
-    for (int i = 0; i < 3; ++i) {
-      (*min)[i] = std::min((*min)[i], pt[i]);
-      (*max)[i] = std::max((*max)[i], pt[i]);
+size_t UniformGrid::memoryUsage() const {
+  size_t bytes = cellOffsets.capacity() * sizeof(uint32_t) +
+                 cellItems.capacity() * sizeof(uint32_t) +
+                 items.capacity() * sizeof(GridItem) +
+                 subGrids.capacity() * sizeof(subGrids[0]);
+  for (const auto& subGrid : subGrids) {
+    if (subGrid) {
+      bytes += sizeof(UniformGrid) + subGrid->memoryUsage();
     }
   }
+  return bytes;
 }
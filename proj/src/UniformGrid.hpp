@@ -1,25 +1,45 @@
 #pragma once
 
+#include <cstdint>
 #include <list>
-#include <set>
+#include <memory>
+#include <vector>
 
 #include "algebra.hpp"
+#include "BoundingBox.hpp"
 #include "Model.hpp"
-#include "primitives/Cube.hpp"
 #include "Ray.hpp"
 
 class UniformGrid {
  public:
+  // If splitMeshes is set, each face of a mesh is stored on its own.
+  // With more than one level, crowded cells get a finer grid of their own,
+  // and so on until there are that many levels in total.
+  // The cells are filled using threadCount threads.
   UniformGrid(const std::list<Model>& models,
               const Point3D& minPoint, const Point3D& maxPoint,
-              uint32_t sizeFactor);
+              uint32_t sizeFactor, bool splitMeshes, uint32_t levels,
+              uint32_t threadCount);
 
-  // Get all models that this ray intersects
-  std::set<const Model*> getModels(const Ray& ray) const;
+  // Find the closest model hit by ray. Cells are tested front to back, so
+  // this stops as soon as the closest hit lies inside the current cell.
+  bool intersects(const Ray& ray, HitRecord* hitRecord) const;
+  // Whether anything blocks ray between tMin and tMax. Stops at the first
+  // item that does.
+  bool occludes(const Ray& ray, double tMin, double tMax) const;
+
+  // Memory held by the cells, in bytes
+  size_t memoryUsage() const;
 
  private:
-  struct GridCell {
-    std::vector<const Model*> models;
+  // What the grid stores: a whole model, or one face of a mesh
+  struct GridItem {
+    GridItem(const Model* model_, int face_) : model(model_), face(face_) {}
+    const Model* model;
+    // -1 for the whole model
+    int face;
+    bool intersects(const Ray& ray, HitRecord* hitRecord) const;
+    bool occludes(const Ray& ray, double tMin, double tMax) const;
   };
 
   struct CellCoord {
@@ -39,17 +59,34 @@ class UniformGrid {
     }
   };
 
-  std::vector<GridCell> cells;
+  // Only the top level grid has items. Sub-grids refer to the same
+  // indices, so one mailbox serves every level.
+  std::vector<GridItem> items;
+  // The cells, stored compactly: cell c holds the items indexed by
+  // cellItems[cellOffsets[c]] up to (not including)
+  // cellItems[cellOffsets[c + 1]]
+  std::vector<uint32_t> cellOffsets;
+  std::vector<uint32_t> cellItems;
+  // Finer grids for crowded cells, indexed by cell. Empty if there are none.
+  std::vector<std::unique_ptr<UniformGrid>> subGrids;
+  // Number of sub-grids below this one, at every level
+  size_t subGridCount = 0;
 
-  double cellSize;
-  // Number of cells on one side (same on x, y, z)
-  int sideLength;
+  // Size of one cell, which need not be a cube
+  Vector3D cellSize;
+  // Number of cells along each of x, y, z
+  CellCoord cellCounts = CellCoord(0, 0, 0);
   Point3D startPoint;
+  // The whole grid
+  BoundingBox bounds;
+
+  // A sub-grid covering box, holding the given items of the top level
+  UniformGrid(const std::vector<GridItem>& allItems,
+              const std::vector<uint32_t>& members, const BoundingBox& box,
+              uint32_t sizeFactor, uint32_t levels);
 
-  // Used for a variety of cube intersections
-  Cube utilityCube;
-  Matrix4x4 cellSizeScaleMatrix;
-  Matrix4x4 gridSizeScaleMatrix;
+  // Choose the cell counts and sizes for itemCount items in bounds
+  void fitCells(size_t itemCount, uint32_t sizeFactor);
 
   // Get index in the vector
   int indexFor(const CellCoord& coord) const;
@@ -59,11 +96,34 @@ class UniformGrid {
   CellCoord coordAt(int index) const;
   // Point in space a cell coordinate corresponds to (bottom left corner)
   Point3D pointAt(const CellCoord& coord) const;
-  bool inGrid(const Point3D& pt) const;
 
-  bool intersectsCell(const Model& model, const CellCoord& coord);
-  void populateCells(const std::list<Model>& models);
+  // The box of space covered by a cell
+  BoundingBox cellBounds(const CellCoord& coord) const;
+  // Put each of members (indices into allItems) into every cell it
+  // overlaps. Each thread finds the items for its own set of cell columns,
+  // then the cells are counted and copied into place, so no locking is
+  // needed.
+  void populateCells(const std::vector<GridItem>& allItems,
+                     const std::vector<uint32_t>& members,
+                     uint32_t threadCount);
+  // Give each crowded cell a sub-grid with levels - 1 levels
+  void buildSubGrids(const std::vector<GridItem>& allItems,
+                       uint32_t sizeFactor, uint32_t levels,
+                       uint32_t threadCount);
+
+  // Test the items in each cell ray passes through, descending into
+  // sub-grids, until a hit is found that no later cell can beat
+  bool intersectsCells(const std::vector<GridItem>& allItems,
+                       const Ray& ray, HitRecord* hitRecord,
+                       uint64_t rayId, uint64_t* visited) const;
+  // Likewise for occludes, stopping once the cells are past tMax
+  bool occludesCells(const std::vector<GridItem>& allItems,
+                     const Ray& ray, double tMin, double tMax,
+                     uint64_t rayId, uint64_t* visited) const;
 
-  void getMinAndMax(const std::vector<Point3D>& pts,
-                    Point3D* min, Point3D* max) const;
+  // Step through the cells that ray passes through, in order (3D-DDA).
+  // visit(cellIndex, tExit) is given the t at which the ray leaves the cell
+  // and returns true to stop the walk.
+  template <typename Visitor>
+  void walk(const Ray& ray, Visitor visit) const;
 };
@@ -25,3 +25,9 @@ std::vector<Point3D> AreaLight::getPoints(size_t n) const {
   }
   return points;
 }
+
+BoundingBox AreaLight::getBounds() const {
+  BoundingBox box(position, position);
+  box.pad(radius);
+  return box;
+}
@@ -9,6 +9,7 @@ class AreaLight : public Light {
             Colour&& c, Point3D&& posn, std::array<double, 3> falloff);
 
   std::vector<Point3D> getPoints(size_t n) const override;
+  BoundingBox getBounds() const override;
 
  private:
   const double radius;
@@ -15,6 +15,10 @@ std::vector<Point3D> Light::getPoints(size_t n) const {
   return {position};
 }
 
+BoundingBox Light::getBounds() const {
+  return BoundingBox(position, position);
+}
+
 double Light::getFalloff(double dist) const {
   return falloff[0] + falloff[1]*dist + falloff[2]*dist*dist;
 }
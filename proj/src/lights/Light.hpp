@@ -3,6 +3,7 @@
 #include <array>
 
 #include "algebra.hpp"
+#include "BoundingBox.hpp"
 
 // Represents a simple point light.
 class Light {
@@ -11,6 +12,8 @@ class Light {
 
   // Return at most n points to use for this light
   virtual std::vector<Point3D> getPoints(size_t n) const;
+  // Box around every point getPoints might return
+  virtual BoundingBox getBounds() const;
   Colour getColour() const;
   double getFalloff(double dist) const;
 
@@ -1,10 +1,33 @@
+#include <atomic>
+#include <csignal>
+#include <cstdio>
 #include <iostream>
 
 #include <map>
 #include <set>
+#include <stdexcept>
 #include <string>
+#include <vector>
 
+#include "AovImages.hpp"
+#include "RenderServer.hpp"
 #include "scene_lua.hpp"
+#include "TraceRecorder.hpp"
+
+namespace {
+// Set on the first Ctrl-C, which makes the render stop and save what it has
+std::atomic<bool> interrupted(false);
+
+extern "C" void interrupt(int) {
+  interrupted = true;
+  // A second one quits right away
+  std::signal(SIGINT, SIG_DFL);
+}
+
+const char* programName = "rt";
+
+// If set, record a timeline of the render and write it here
+std::string traceFile;
 
 struct Argument {
   Argument() {}
@@ -12,57 +35,122 @@ struct Argument {
   bool hasValue = false;
 };
 
-int main(int argc, char** argv) {
-  auto printUsage = [&] () {
-    std::cerr
-      << "Usage: " << argv[0] << " file [-t threads] [-p] [-g] [-u gridfactor] "
-      "[-a tolerance] [-d depth] [-s shadows] [-r reflections] [-h help]"
-      << std::endl
-      << "\t-h:  Show this help and exit" << std::endl
-      << "\t-t:  Number of threads to use. Default is 4." << std::endl
-      << "\t-p:  Use phong interpolation." << std::endl
-      << "\t-g:  Use a uniform grid structure." << std::endl
-      << "\t-u:  Uniform grid size factor. Requires -g. Default 8." << std::endl
-      << "\t-a:  Antialiasing tolerance. Default is 0.2." << std::endl
-      << "\t-d:  Maxmimum antialiasing depth. Default is 0 (off)." << std::endl
-      << "\t-s:  Soft shadow sample count. Use 1 to disable." << std::endl
-      << "\t-r:  Samples to use for glossy reflection. Use 1 to disable." << std::endl
-      << "\t-m:  Maximum recursive depth. Default is 2." << std::endl;
-  };
-
-  if (argc < 2) {
-    std::cerr << "Scene file required." << std::endl;
-    printUsage();
-    return 1;
-  }
+void printUsage() {
+  std::cerr
+    << "Usage: " << programName << " file [-t threads] [-p] [-g] [-l levels] [-u gridfactor] [-f] [-b] "
+    "[-a tolerance] [-d depth] [-v noise] [-n samples] [-i seconds] [-w seconds] [-c rays] "
+    "[-s shadows] [-r reflections] [--checkpoint] [--resume] [--crop x,y,w,h] "
+    "[--workers n] [--listen socket] [--worker socket] [--stats] [--stats-json file] [--trace file] "
+    "[--aov kinds] "
+    "[--serve socket] [--submit socket] [-h help]"
+    << std::endl
+    << "\t-h:  Show this help and exit" << std::endl
+    << "\t-t:  Number of threads to use. Default is one per core." << std::endl
+    << "\t-p:  Use phong interpolation." << std::endl
+    << "\t-g:  Use a uniform grid structure." << std::endl
+    << "\t-l:  Grid levels. Crowded cells get finer sub-grids. Implies -g. Default 1." << std::endl
+    << "\t-u:  Uniform grid size factor. Requires -g. Default 8." << std::endl
+    << "\t-f:  Put mesh faces into the grid individually. Requires -g." << std::endl
+    << "\t-b:  Use a bounding volume hierarchy. Overrides -g." << std::endl
+    << "\t-a:  Antialiasing tolerance. Default is 0.2." << std::endl
+    << "\t-d:  Maxmimum antialiasing depth. Default is 0 (off)." << std::endl
+    << "\t-v:  Sample each pixel until its noise is below this. Replaces -d." << std::endl
+    << "\t-n:  Average samples per pixel -v may use. Default 64." << std::endl
+    << "\t-i:  Render progressively, saving the image every this many seconds." << std::endl
+    << "\t-w:  Stop after this many seconds and save what has been rendered." << std::endl
+    << "\t-c:  Stop after this many camera rays and save what has been rendered." << std::endl
+    << "\t-s:  Soft shadow sample count. Use 1 to disable." << std::endl
+    << "\t-r:  Samples to use for glossy reflection. Use 1 to disable." << std::endl
+    << "\t-m:  Maximum recursive depth. Default is 2." << std::endl
+    << "\t--checkpoint:  Keep a checkpoint to resume from if the render is stopped. Implied by -w, -c and --resume." << std::endl
+    << "\t--resume:  Carry on from the checkpoint a stopped render left." << std::endl
+    << "\t--crop:  Only render the w x h pixels at (x, y). Stitch the parts with rt-merge." << std::endl
+    << "\t--workers:  Fork this many worker processes and hand them tiles." << std::endl
+    << "\t--listen:  Socket to hand tiles out on. Default is the output name with .sock." << std::endl
+    << "\t--worker:  Render tiles for the rt listening at this socket instead." << std::endl
+    << "\t--stats:  Count rays and intersection tests, and report them at the end." << std::endl
+    << "\t--stats-json:  Like --stats, and write the counts to this file as JSON too." << std::endl
+    << "\t--trace:  Write a timeline of the render here, for chrome://tracing or Perfetto." << std::endl
+    << "\t--aov:  Also save these per-pixel images beside the output, separated by commas: rays, time, aa, cells, depth, normal." << std::endl
+    << "\t--serve:  Run render jobs sent to this socket, keeping meshes and textures loaded." << std::endl
+    << "\t--submit:  Have the rt serving at this socket do the render." << std::endl;
+}
 
+// Set rayTracerOptions and *filename from the command line, without the
+// program name. Returns false, having said why, if there is nothing to
+// render.
+bool parseArguments(const std::vector<std::string>& arguments,
+                    std::string* filename) {
   std::map<char, Argument> argMap = {
     {'p', {false}},
     {'g', {false}},
+    {'f', {false}},
+    {'b', {false}},
     {'h', {false}},
     {'t', {true}},
     {'u', {true}},
+    {'l', {true}},
     {'a', {true}},
     {'d', {true}},
+    {'v', {true}},
+    {'n', {true}},
+    {'i', {true}},
+    {'w', {true}},
+    {'c', {true}},
     {'s', {true}},
     {'r', {true}},
     {'m', {true}},
   };
 
+  // Options too rarely used to spend a letter on, given as --name
+  std::map<std::string, Argument> longArgMap = {
+    {"checkpoint", {false}},
+    {"resume", {false}},
+    {"crop", {true}},
+    {"workers", {true}},
+    {"listen", {true}},
+    {"worker", {true}},
+    {"stats", {false}},
+    {"stats-json", {true}},
+    {"trace", {true}},
+    {"aov", {true}},
+  };
+
   std::set<char> flags;
   std::map<char, std::string> args;
-
-  std::string filename;
+  std::set<std::string> longFlags;
+  std::map<std::string, std::string> longArgs;
 
   // Pull out options
-  for (int i = 1; i < argc; ++i) {
+  for (size_t i = 0; i < arguments.size(); ++i) {
     // If we spot a flag, get the next arg as the value
-    std::string argStr = argv[i];
+    const std::string& argStr = arguments[i];
+    if (argStr.size() > 2 && argStr.compare(0, 2, "--") == 0) {
+      const auto name = argStr.substr(2);
+      const auto found = longArgMap.find(name);
+      if (found == longArgMap.end()) {
+        std::cerr << "Unknown option: " << argStr << std::endl;
+        printUsage();
+        return false;
+      }
+      if (!found->second.hasValue) {
+        longFlags.insert(name);
+        continue;
+      }
+      if (i + 1 >= arguments.size()) {
+        std::cerr << "Missing value for option " << argStr << std::endl;
+        printUsage();
+        return false;
+      }
+      longArgs[name] = arguments[i + 1];
+      i += 1;
+      continue;
+    }
     if (argStr.size() != 2 || argStr[0] != '-') {
-      if (filename.empty() && argStr[0] != '-') {
+      if (filename->empty() && argStr[0] != '-') {
         // We didn't yet find the filename, so treat this unmatched argument
         // as the filename (but only if it doesn't start with a dash)
-        filename = argStr;
+        *filename = argStr;
         continue;
       }
       else {
@@ -70,7 +158,7 @@ int main(int argc, char** argv) {
         // argument: Error out
         std::cerr << "Unknown option: " << argStr << std::endl;
         printUsage();
-        return 1;
+        return false;
       }
     }
 
@@ -79,19 +167,19 @@ int main(int argc, char** argv) {
       // Not in our map: Error out
       std::cerr << "Unknown option: " << argStr << std::endl;
       printUsage();
-      return 1;
+      return false;
     }
 
     const auto& arg = argMap[option];
     std::string argVal;
     if (arg.hasValue) {
-      if (i + 1 >= argc) {
+      if (i + 1 >= arguments.size()) {
         // Not enough arguments
         std::cerr << "Missing value for option " << argStr << std::endl;
         printUsage();
-        return 1;
+        return false;
       }
-      argVal = argv[i + 1];
+      argVal = arguments[i + 1];
       i += 1;
       args[option] = argVal;
     }
@@ -109,9 +197,15 @@ int main(int argc, char** argv) {
     case 'g':
       rayTracerOptions.uniformGrid = true;
       break;
+    case 'f':
+      rayTracerOptions.splitMeshes = true;
+      break;
+    case 'b':
+      rayTracerOptions.boundingVolumeHierarchy = true;
+      break;
     case 'h':
       printUsage();
-      return 1;
+      return false;
     }
   }
 
@@ -121,7 +215,7 @@ int main(int argc, char** argv) {
       {
       int numThreads = std::stoi(arg.second);
       // Enforce reasonable limits
-      if (numThreads <= 0 || numThreads >= 32) {
+      if (numThreads <= 0) {
         std::cerr << "Invalid number of threads: " << numThreads << std::endl;
         printUsage();
       }
@@ -139,6 +233,17 @@ int main(int argc, char** argv) {
       rayTracerOptions.uniformGridSizeFactor = constant;
       break;
       }
+    case 'l':
+      {
+      int levels = std::stoi(arg.second);
+      if (levels <= 0) {
+        std::cerr << "Invalid grid levels: " << levels << std::endl;
+        printUsage();
+      }
+      rayTracerOptions.uniformGrid = true;
+      rayTracerOptions.uniformGridLevels = levels;
+      break;
+      }
     case 'a':
       {
       double tolerance = std::stod(arg.second);
@@ -152,6 +257,49 @@ int main(int argc, char** argv) {
     case 'd':
       rayTracerOptions.aaDepth = std::stoi(arg.second);
       break;
+    case 'v':
+      {
+      double target = std::stod(arg.second);
+      if (target <= 0) {
+        std::cerr << "Invalid noise target: " << target << std::endl;
+        printUsage();
+      }
+      rayTracerOptions.noiseTarget = target;
+      break;
+      }
+    case 'n':
+      {
+      int budget = std::stoi(arg.second);
+      if (budget <= 0) {
+        std::cerr << "Invalid sample budget: " << budget << std::endl;
+        printUsage();
+      }
+      rayTracerOptions.sampleBudget = budget;
+      break;
+      }
+    case 'i':
+      {
+      double interval = std::stod(arg.second);
+      if (interval <= 0) {
+        std::cerr << "Invalid snapshot interval: " << interval << std::endl;
+        printUsage();
+      }
+      rayTracerOptions.snapshotInterval = interval;
+      break;
+      }
+    case 'w':
+      {
+      double limit = std::stod(arg.second);
+      if (limit <= 0) {
+        std::cerr << "Invalid time limit: " << limit << std::endl;
+        printUsage();
+      }
+      rayTracerOptions.timeLimit = limit;
+      break;
+      }
+    case 'c':
+      rayTracerOptions.rayLimit = std::stoull(arg.second);
+      break;
     case 's':
       rayTracerOptions.shadowSamples = std::stoul(arg.second);
       break;
@@ -164,8 +312,126 @@ int main(int argc, char** argv) {
     }
   }
 
-  if (!run_lua(filename)) {
-    std::cerr << "Could not open " << filename << std::endl;
+  for (const auto& name : longFlags) {
+    if (name == "checkpoint") {
+      rayTracerOptions.checkpoint = true;
+    }
+    else if (name == "resume") {
+      rayTracerOptions.resume = true;
+    }
+    else if (name == "stats") {
+      rayTracerOptions.showCounters = true;
+    }
+  }
+  for (const auto& arg : longArgs) {
+    if (arg.first == "crop") {
+      unsigned x, y, w, h;
+      char end;
+      if (std::sscanf(arg.second.c_str(), "%u,%u,%u,%u%c",
+                      &x, &y, &w, &h, &end) != 4 || w == 0 || h == 0) {
+        std::cerr << "Invalid crop: " << arg.second << std::endl;
+        printUsage();
+        return false;
+      }
+      rayTracerOptions.crop = {x, y, x + w, y + h};
+    }
+    else if (arg.first == "workers") {
+      rayTracerOptions.workerProcesses = std::stoul(arg.second);
+    }
+    else if (arg.first == "listen") {
+      rayTracerOptions.coordinatorSocket = arg.second;
+    }
+    else if (arg.first == "worker") {
+      rayTracerOptions.workerSocket = arg.second;
+    }
+    else if (arg.first == "stats-json") {
+      rayTracerOptions.countersFile = arg.second;
+    }
+    else if (arg.first == "trace") {
+      traceFile = arg.second;
+    }
+    else if (arg.first == "aov") {
+      if (!AovImages::parse(arg.second, &rayTracerOptions.aovs)) {
+        printUsage();
+        return false;
+      }
+    }
+  }
+
+  if (filename->empty()) {
+    std::cerr << "Scene file required." << std::endl;
+    printUsage();
+    return false;
+  }
+  return true;
+}
+
+// Render the scene in filename
+int render(const std::string& filename) {
+  if (!traceFile.empty()) {
+    trace::start();
+  }
+  const bool rendered = run_lua(filename);
+  if (!rendered) {
+    std::cerr << "Could not render " << filename << std::endl;
+  }
+  // Even a failed render's trace says how far it got
+  if (!traceFile.empty() && !trace::finish(traceFile)) {
     return 1;
   }
+  return rendered ? 0 : 1;
 }
+
+} // Anonymous
+
+int main(int argc, char** argv) {
+  programName = argv[0];
+  std::vector<std::string> arguments(argv + 1, argv + argc);
+
+  // The server options say where the render happens, so they are taken out
+  // before the rest
+  std::string serveSocket, submitSocket;
+  for (size_t i = 0; i + 1 < arguments.size();) {
+    if (arguments[i] == "--serve" || arguments[i] == "--submit") {
+      auto& socket = arguments[i] == "--serve" ? serveSocket : submitSocket;
+      socket = arguments[i + 1];
+      arguments.erase(arguments.begin() + i, arguments.begin() + i + 2);
+    }
+    else {
+      i += 1;
+    }
+  }
+
+  if (!serveSocket.empty()) {
+    RenderServer server(serveSocket);
+    if (!server.isListening()) return 1;
+    server.run([] (const std::vector<std::string>& args) {
+      // Each job starts from the defaults, whatever the last one set
+      rayTracerOptions = RayTracer::Options();
+      traceFile.clear();
+      std::string filename;
+      try {
+        if (!parseArguments(args, &filename)) return 1;
+      }
+      catch (const std::exception&) {
+        // Bad numbers end a plain rt, but must not end the server
+        std::cerr << "Invalid option value" << std::endl;
+        return 1;
+      }
+      rayTracerOptions.cancelled = &interrupted;
+      return render(filename);
+    }, &interrupted);
+    return 1;
+  }
+
+  std::signal(SIGINT, interrupt);
+  if (!submitSocket.empty()) {
+    return submitRenderJob(submitSocket, arguments, interrupted);
+  }
+
+  std::string filename;
+  if (!parseArguments(arguments, &filename)) return 1;
+  rayTracerOptions.cancelled = &interrupted;
+  return render(filename);
+}
+
@@ -2,6 +2,7 @@
 
 #include "lodepng.h"
 
+#include "AssetCache.hpp"
 #include "HitRecord.hpp"
 
 TextureMaterial::TextureMaterial(
@@ -9,34 +10,46 @@ TextureMaterial::TextureMaterial(
     const Colour& ks_, double shininess_, double alpha_, double idx_)
     : Material(ks_, shininess_, alpha_, idx_), texture(readTexture(filename)) {}
 
-TextureMaterial::Texture TextureMaterial::readTexture(
-    const std::string& filename) const {
-  std::vector<unsigned char> image;
-
-  Texture texture;
-  unsigned error = lodepng::decode(
-      image, texture.width, texture.height, filename);
-  if (error) {
-    std::cerr << "Error reading PNG: " << error << ": "
-              << lodepng_error_text(error) << std::endl;
-  }
-  texture.data.reserve(image.size());
-
-  // Four bytes at a time. RGBA.
-  for (size_t i = 0; i < image.size(); i += 4) {
-    texture.data.emplace_back(Colour(
-          image[i] / 255.0, image[i + 1] / 255.0, image[i + 2] / 255.0));
+std::shared_ptr<const TextureMaterial::Texture> TextureMaterial::readTexture(
+    const std::string& filename) {
+  static AssetCache<Texture> cache;
+  auto decode = [] (const std::string& filename) {
+    std::vector<unsigned char> image;
+
+    auto texture = std::make_shared<Texture>();
+    unsigned error = lodepng::decode(
+        image, texture->width, texture->height, filename);
+    if (error) {
+      std::cerr << "Error reading PNG: " << error << ": "
+                << lodepng_error_text(error) << std::endl;
+      // Not cached, so it is tried again next time
+      return std::shared_ptr<Texture>();
+    }
+    texture->data.reserve(image.size());
+
+    // Four bytes at a time. RGBA.
+    for (size_t i = 0; i < image.size(); i += 4) {
+      texture->data.emplace_back(Colour(
+            image[i] / 255.0, image[i + 1] / 255.0, image[i + 2] / 255.0));
+    }
+    return texture;
+  };
+
+  auto texture = cache.get(filename, decode);
+  if (!texture) {
+    texture = std::make_shared<Texture>();
+    texture->width = 0;
+    texture->height = 0;
   }
-
   return texture;
 }
 
 Colour TextureMaterial::getKd(const HitRecord& hitRecord) const {
   if (hitRecord.xPercent < 0 || hitRecord.yPercent < 0) return Colour(0, 0, 0);
 
-  size_t xPx = (size_t) (hitRecord.xPercent * texture.width);
-  size_t yPx = (size_t) (hitRecord.yPercent * texture.height);
+  size_t xPx = (size_t) (hitRecord.xPercent * texture->width);
+  size_t yPx = (size_t) (hitRecord.yPercent * texture->height);
   // Invert y part because model is bottom to top and image is top to bottom
-  yPx = texture.height - yPx;
-  return texture.data[(yPx * texture.width) + xPx];
+  yPx = texture->height - yPx;
+  return texture->data[(yPx * texture->width) + xPx];
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -21,6 +22,8 @@ class TextureMaterial : public Material {
     unsigned width;
     unsigned height;
   };
-  Texture texture;
-  Texture readTexture(const std::string& filename) const;
+  // Shared by every material using the same file
+  std::shared_ptr<const Texture> texture;
+  static std::shared_ptr<const Texture> readTexture(
+      const std::string& filename);
 };
@@ -4,12 +4,14 @@
 #include "HitRecord.hpp"
 #include "polyroots.hpp"
 #include "Ray.hpp"
+#include "RenderCounters.hpp"
 
 using namespace primitives;
 
 bool Cube::intersects(const Ray& ray,
                       HitRecord* hitRecord,
                       const Matrix4x4& inverseTransform) const {
+  counters::countIntersects(RenderCounters::CUBE);
   // New ray
   const auto a = inverseTransform * ray.start;
   const auto b = inverseTransform * ray.other;
@@ -47,6 +49,15 @@ bool Cube::intersects(const Ray& ray,
   return hitRecord->update(norm, point, t);
 }
 
+bool Cube::occludes(const Ray& ray, double tMax,
+                    const Matrix4x4& inverseTransform) const {
+  counters::countOccludes(RenderCounters::CUBE);
+  const auto a = inverseTransform * ray.start;
+  const auto b = inverseTransform * ray.other;
+  const double t = solveIntersection(a, b - a);
+  return t >= 0 && t < tMax;
+}
+
 double Cube::solveIntersection(const Point3D& a, const Vector3D& dir) const {
   int count = 0;
   double minT = -1;
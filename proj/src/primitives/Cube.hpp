@@ -7,6 +7,8 @@ class Cube : public Primitive {
   bool intersects(const Ray& ray,
                   HitRecord* hitRecord,
                   const Matrix4x4& inverseTransform) const override;
+  bool occludes(const Ray& ray, double tMax,
+                const Matrix4x4& inverseTransform) const override;
   Point3D getMinPoint(const Matrix4x4& inverseTransform) const override;
   Point3D getMaxPoint(const Matrix4x4& inverseTransform) const override;
   std::vector<Point3D>
@@ -3,12 +3,14 @@
 #include "HitRecord.hpp"
 #include "polyroots.hpp"
 #include "Ray.hpp"
+#include "RenderCounters.hpp"
 
 using namespace primitives;
 
 bool Cylinder::intersects(const Ray& ray,
                           HitRecord* hitRecord,
                           const Matrix4x4& inverseTransform) const {
+  counters::countIntersects(RenderCounters::CYLINDER);
   // New ray
   const auto p1 = inverseTransform * ray.start;
   const auto p2 = inverseTransform * ray.other;
@@ -44,6 +46,15 @@ bool Cylinder::intersects(const Ray& ray,
   return hitRecord->update(norm, point, t);
 }
 
+bool Cylinder::occludes(const Ray& ray, double tMax,
+                        const Matrix4x4& inverseTransform) const {
+  counters::countOccludes(RenderCounters::CYLINDER);
+  const auto p1 = inverseTransform * ray.start;
+  const auto p2 = inverseTransform * ray.other;
+  const double t = solveIntersection(p1, p2 - p1);
+  return t >= 0 && t < tMax;
+}
+
 double Cylinder::solveIntersection(const Point3D& p1, const Vector3D& dir)
 const {
   auto t = mostValid(getCapT(p1, dir), getWallT(p1, dir));
@@ -108,6 +119,41 @@ double Cylinder::getWallT(const Point3D& p1, const Vector3D& dir) const {
   return mostValid(roots[0], roots[1]);
 }
 
+bool Cylinder::overlapsBox(const BoundingBox& box,
+                           const Matrix4x4& inverseTransform) const {
+  // Outside the transformed bounding box means definitely no overlap
+  if (!Primitive::overlapsBox(box, inverseTransform)) {
+    return false;
+  }
+
+  const auto xform = inverseTransform.invert();
+  double radius;
+  if (!uniformInXY(xform, &radius)) {
+    // Elliptic cross section: the bounding box is the best we have
+    return true;
+  }
+
+  // The cylinder lies inside the capsule around its axis with the same
+  // radius, so if the axis is too far from the box we can rule it out. The
+  // squared distance to the box is convex along the axis, so a ternary
+  // search finds its minimum.
+  const auto a = xform * Point3D(0, 0, -1);
+  const auto axis = xform * Point3D(0, 0, 1) - a;
+  double lo = 0;
+  double hi = 1;
+  for (int i = 0; i < 50; ++i) {
+    const double m1 = lo + (hi - lo) / 3;
+    const double m2 = hi - (hi - lo) / 3;
+    if (box.distance2(a + m1 * axis) <= box.distance2(a + m2 * axis)) {
+      hi = m2;
+    }
+    else {
+      lo = m1;
+    }
+  }
+  return box.distance2(a + lo * axis) <= radius * radius * (1 + 1e-9);
+}
+
 Point3D Cylinder::getMinPoint(const Matrix4x4& inverseTransform) const {
   return boundingCube.getMinPoint(cubeInv * inverseTransform);
 }
@@ -7,6 +7,7 @@
 
 #include "HitRecord.hpp"
 #include "Ray.hpp"
+#include "RenderCounters.hpp"
 #include "xform.hpp"
 
 bool Mesh::interpolateNormals = true;
@@ -16,7 +17,8 @@ Mesh::Mesh(std::vector<Point3D>&& verts,
            const FaceInput& faces)
      : m_verts(std::move(verts)),
        m_faces(getFaces(faces)),
-       m_normals(getNormals(std::move(normals))) {
+       m_normals(getNormals(std::move(normals))),
+       m_faceHierarchy(getFaceBounds()) {
 
   Point3D smallPoint(m_verts[0][0], m_verts[0][1], m_verts[0][2]);
   Point3D largePoint(smallPoint);
@@ -45,21 +47,20 @@ Mesh::Mesh(std::vector<Point3D>&& verts,
   boundingCubeInverse = scale * xlate;
 }
 
-bool Mesh::faceIntersection(
-    const Ray& ray, HitRecord* hitRecord, const Mesh::Face& face) const {
+double Mesh::faceHit(const Ray& ray, const Mesh::Face& face) const {
   // Get a point on the plane
-  Vector3D norm = face.normal;
+  const Vector3D& norm = face.normal;
 
   const auto rayNorm = ray.dir.dot(norm);
 
   // Parallel
-  if (isZero(rayNorm)) return false;
+  if (isZero(rayNorm)) return -1;
 
   const auto& p0 = face.vertices.front().vertex();
   const double t = (p0 - ray.start).dot(norm) / rayNorm;
   // No intersection
   if (t < 0 || isZero(t)) {
-    return false;
+    return -1;
   }
 
   // Intersection point
@@ -75,10 +76,20 @@ bool Mesh::faceIntersection(
     auto k = norm.dot(side.cross(planePt - p1));
     if (!isZero(k) && k < 0) {
       // Zero means on the side; negative means opposite dir from norm
-      return false;
+      return -1;
     }
   }
+  return t;
+}
+
+bool Mesh::faceIntersection(
+    const Ray& ray, HitRecord* hitRecord, const Mesh::Face& face) const {
+  counters::countIntersects(RenderCounters::MESH_FACE);
+  const double t = faceHit(ray, face);
+  if (t < 0) return false;
 
+  const auto planePt = ray.at(t);
+  Vector3D norm = face.normal;
   if (interpolateNormals) {
     norm = interpolatedNormal(face, planePt);
   }
@@ -101,34 +112,75 @@ void Mesh::getXYPercent(
 bool Mesh::intersects(const Ray& ray,
                       HitRecord* hitRecord,
                       const Matrix4x4& inverseTransform) const {
+  counters::countIntersects(RenderCounters::MESH);
   // New ray
   const auto a = inverseTransform * ray.start;
   const auto b = inverseTransform * ray.other;
   const Ray newRay(a, b);
 
-  HitRecord boundingRecord;
+  // The hierarchy only hands us faces whose bounds the ray passes through,
+  // nearest first
+  return m_faceHierarchy.intersects(newRay, hitRecord, [&] (uint32_t i) {
+    return faceIntersection(
+        ray, newRay, hitRecord, m_faces[i], inverseTransform);
+  });
+}
 
-  // First, check for intersection against our bounding box
-  if (!boundingCube.intersects(
-        ray, &boundingRecord, boundingCubeInverse * inverseTransform)) {
+bool Mesh::faceIntersection(const Ray& ray, const Ray& localRay,
+                            HitRecord* hitRecord, const Mesh::Face& face,
+                            const Matrix4x4& inverseTransform) const {
+  if (!faceIntersection(localRay, hitRecord, face)) {
     return false;
   }
+  // Use real ray
+  hitRecord->point = ray.at(hitRecord->t);
+  hitRecord->norm = inverseTransform.transpose() * hitRecord->norm;
+  hitRecord->norm.normalize();
+  return true;
+}
 
-  // Note: This is not implemented correctly, since faceIntersection
-  // checks if the face was intersected *and* was a better t value
-  bool hit = false;
-  // For each polygon, check for polygon intersection lol...
-  for (const auto& face : m_faces) {
-    if (faceIntersection(newRay, hitRecord, face)) {
-      // Use real ray
-      hitRecord->point = ray.at(hitRecord->t);
-      hitRecord->norm = inverseTransform.transpose() * hitRecord->norm;
-      hitRecord->norm.normalize();
-      hit = true;
-    }
+bool Mesh::occludes(const Ray& ray, double tMax,
+                    const Matrix4x4& inverseTransform) const {
+  counters::countOccludes(RenderCounters::MESH);
+  const Ray localRay(inverseTransform * ray.start,
+                     inverseTransform * ray.other);
+  return m_faceHierarchy.occludes(localRay, 0, tMax, [&] (uint32_t i) {
+    counters::countOccludes(RenderCounters::MESH_FACE);
+    const double t = faceHit(localRay, m_faces[i]);
+    return t >= 0 && t < tMax;
+  });
+}
+
+size_t Mesh::faceCount() const {
+  return m_faces.size();
+}
+
+bool Mesh::intersectsFace(size_t face,
+                          const Ray& ray,
+                          HitRecord* hitRecord,
+                          const Matrix4x4& inverseTransform) const {
+  const Ray localRay(inverseTransform * ray.start,
+                     inverseTransform * ray.other);
+  return faceIntersection(
+      ray, localRay, hitRecord, m_faces[face], inverseTransform);
+}
+
+bool Mesh::occludesFace(size_t face, const Ray& ray, double tMax,
+                        const Matrix4x4& inverseTransform) const {
+  counters::countOccludes(RenderCounters::MESH_FACE);
+  const Ray localRay(inverseTransform * ray.start,
+                     inverseTransform * ray.other);
+  const double t = faceHit(localRay, m_faces[face]);
+  return t >= 0 && t < tMax;
+}
 
+std::vector<Point3D> Mesh::getFaceVertices(
+    size_t face, const Matrix4x4& transform) const {
+  std::vector<Point3D> pts;
+  for (const auto& fv : m_faces[face].vertices) {
+    pts.push_back(transform * fv.vertex());
   }
-  return hit;
+  return pts;
 }
 
 Vector3D Mesh::interpolatedNormal(const Face& face, const Point3D& pt) const {
@@ -245,6 +297,21 @@ std::vector<Vector3D> Mesh::getNormals(std::vector<Vector3D>&& normals_) const {
   return std::move(myNormals);
 }
 
+std::vector<BoundingBox> Mesh::getFaceBounds() const {
+  std::vector<BoundingBox> bounds;
+  bounds.reserve(m_faces.size());
+  for (const auto& face : m_faces) {
+    BoundingBox box;
+    for (const auto& fv : face.vertices) {
+      box.extend(fv.vertex());
+    }
+    // Faces are flat, so give them some thickness
+    box.pad(EPSILON);
+    bounds.push_back(box);
+  }
+  return bounds;
+}
+
 const Point3D& Mesh::FaceVertex::vertex() const {
   return parent->m_verts[m_vertex];
 }
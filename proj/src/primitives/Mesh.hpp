@@ -3,6 +3,7 @@
 #include <vector>
 
 #include "algebra.hpp"
+#include "BoundingVolumeHierarchy.hpp"
 #include "Cube.hpp"
 #include "Primitive.hpp"
 
@@ -20,12 +21,27 @@ class Mesh : public Primitive {
   bool intersects(const Ray& ray,
                   HitRecord* hitRecord,
                   const Matrix4x4& inverseTransform) const override;
+  bool occludes(const Ray& ray, double tMax,
+                const Matrix4x4& inverseTransform) const override;
   Point3D getMinPoint(const Matrix4x4& inverseTransform) const override;
   Point3D getMaxPoint(const Matrix4x4& inverseTransform) const override;
 
   std::vector<Point3D> getBoundingBox(const Matrix4x4& inverseTransform)
       const override;
 
+  // Faces can also be handed out one at a time, e.g. so that a grid can put
+  // each one in only the cells it touches
+  size_t faceCount() const;
+  bool intersectsFace(size_t face,
+                      const Ray& ray,
+                      HitRecord* hitRecord,
+                      const Matrix4x4& inverseTransform) const;
+  bool occludesFace(size_t face, const Ray& ray, double tMax,
+                    const Matrix4x4& inverseTransform) const;
+  // Vertices of a face after applying transform
+  std::vector<Point3D> getFaceVertices(size_t face,
+                                       const Matrix4x4& transform) const;
+
   static bool interpolateNormals;
 
  private:
@@ -67,15 +83,26 @@ class Mesh : public Primitive {
   const std::vector<Point3D> m_verts;
   const std::vector<Face> m_faces;
   const std::vector<Vector3D> m_normals;
+  // Built once over the faces in model coordinates, so every Model using
+  // this mesh shares it
+  const BoundingVolumeHierarchy m_faceHierarchy;
 
   Cube boundingCube;
   Matrix4x4 boundingCubeInverse;
 
+  // The t at which ray hits face, or -1 if it misses
+  double faceHit(const Ray& ray, const Face& face) const;
   bool faceIntersection(
       const Ray& ray, HitRecord* hitRecord, const Face& face) const;
+  // As above, with localRay in model coordinates; the hit record gets
+  // updated with world coordinates
+  bool faceIntersection(const Ray& ray, const Ray& localRay,
+                        HitRecord* hitRecord, const Face& face,
+                        const Matrix4x4& inverseTransform) const;
 
   std::vector<Face> getFaces(const FaceInput& faces) const;
   std::vector<Vector3D> getNormals(std::vector<Vector3D>&& normals) const;
+  std::vector<BoundingBox> getFaceBounds() const;
 
   Vector3D interpolatedNormal(const Face& face, const Point3D& pt) const;
   void getXYPercent(
@@ -1,6 +1,20 @@
 #include "Primitive.hpp"
 
 #include <algorithm>
+#include <cmath>
+
+#include "HitRecord.hpp"
+
+bool Primitive::occludes(const Ray& ray, double tMax,
+                         const Matrix4x4& inverseTransform) const {
+  HitRecord hitRecord;
+  return intersects(ray, &hitRecord, inverseTransform) && hitRecord.t < tMax;
+}
+
+bool Primitive::overlapsBox(const BoundingBox& box,
+                            const Matrix4x4& inverseTransform) const {
+  return box.overlapsParallelepiped(getBoundingBox(inverseTransform));
+}
 
 namespace primitives {
 
@@ -18,4 +32,22 @@ double mostValid(double t1, double t2) {
   return std::min(t1, t2);
 }
 
+bool uniformInXY(const Matrix4x4& xform, double* scale) {
+  const auto x = xform * Vector3D(1, 0, 0);
+  const auto y = xform * Vector3D(0, 1, 0);
+  const auto z = xform * Vector3D(0, 0, 1);
+  const double s = x.length();
+  const double zs = z.length();
+  // Tolerances are relative, since scenes come in all sizes
+  const double tol = 1e-9;
+  if (std::abs(x.length2() - y.length2()) > tol * s * s ||
+      std::abs(x.dot(y)) > tol * s * s ||
+      std::abs(x.dot(z)) > tol * s * zs ||
+      std::abs(y.dot(z)) > tol * s * zs) {
+    return false;
+  }
+  *scale = s;
+  return true;
+}
+
 } // primitives
@@ -3,6 +3,7 @@
 #include <vector>
 
 #include "algebra.hpp"
+#include "BoundingBox.hpp"
 
 class Ray;
 class HitRecord;
@@ -13,10 +14,21 @@ class Primitive {
   virtual bool intersects(const Ray& ray,
                           HitRecord* hitRecord,
                           const Matrix4x4& inverseTransform) const = 0;
+  // Whether ray hits the primitive anywhere with 0 < t < tMax. Only needs
+  // the fact of a hit, so normals and texture coordinates can be skipped.
+  // By default this finds the closest hit in full.
+  virtual bool occludes(const Ray& ray, double tMax,
+                        const Matrix4x4& inverseTransform) const;
   virtual Point3D getMinPoint(const Matrix4x4& inverseTransform) const = 0;
   virtual Point3D getMaxPoint(const Matrix4x4& inverseTransform) const = 0;
   virtual std::vector<Point3D> getBoundingBox(const Matrix4x4& inverseTransform)
       const = 0;
+
+  // Whether any of the transformed primitive might lie in box. This must
+  // never say no when the answer is yes. By default this tests the
+  // transformed bounding box, which is exact only for cubes.
+  virtual bool overlapsBox(const BoundingBox& box,
+                           const Matrix4x4& inverseTransform) const;
 };
 
 namespace primitives {
@@ -24,4 +36,9 @@ namespace primitives {
 bool isValid(double t);
 double mostValid(double t1, double t2);
 
+// If xform scales x and y by the same amount and keeps the axes at right
+// angles (rotation, translation and a z-only stretch allowed), set *scale
+// to that amount and return true.
+bool uniformInXY(const Matrix4x4& xform, double* scale);
+
 }
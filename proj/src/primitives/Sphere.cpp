@@ -7,6 +7,7 @@
 #include "HitRecord.hpp"
 #include "polyroots.hpp"
 #include "Ray.hpp"
+#include "RenderCounters.hpp"
 #include "xform.hpp"
 
 using namespace primitives;
@@ -14,6 +15,7 @@ using namespace primitives;
 bool Sphere::intersects(const Ray& ray,
                         HitRecord* hitRecord,
                         const Matrix4x4& inverseTransform) const {
+  counters::countIntersects(RenderCounters::SPHERE);
   // New ray
   const auto p1 = inverseTransform * ray.start;
   const auto p2 = inverseTransform * ray.other;
@@ -49,6 +51,15 @@ bool Sphere::intersects(const Ray& ray,
   return hitRecord->update(norm, point, t, thetaP, phiP);
 }
 
+bool Sphere::occludes(const Ray& ray, double tMax,
+                      const Matrix4x4& inverseTransform) const {
+  counters::countOccludes(RenderCounters::SPHERE);
+  const auto p1 = inverseTransform * ray.start;
+  const auto p2 = inverseTransform * ray.other;
+  const double t = solveIntersection(p1, p2 - p1);
+  return t >= 0 && t < tMax;
+}
+
 double Sphere::solveIntersection(const Point3D& p1, const Vector3D& dir) const {
   // Now do intersection against unit sphere centred at origin
   // x^2 + y^2 + z^2 = 1
@@ -82,6 +93,20 @@ double Sphere::solveIntersection(const Point3D& p1, const Vector3D& dir) const {
   return t;
 }
 
+bool Sphere::overlapsBox(const BoundingBox& box,
+                         const Matrix4x4& inverseTransform) const {
+  const auto xform = inverseTransform.invert();
+  double radius;
+  // Only a real sphere if z is scaled like x and y
+  if (!uniformInXY(xform, &radius) ||
+      !isZero((xform * Vector3D(0, 0, 1)).length() / radius - 1)) {
+    return Primitive::overlapsBox(box, inverseTransform);
+  }
+  // The sphere touches the box iff the box's closest point is within it
+  const auto centre = xform * Point3D(0, 0, 0);
+  return box.distance2(centre) <= radius * radius * (1 + 1e-9);
+}
+
 Point3D Sphere::getMinPoint(const Matrix4x4& inverseTransform) const {
   auto cubeInv = translationMatrix(-1, -1, -1) * scaleMatrix(2, 2, 2);
   cubeInv = cubeInv.invert();
@@ -8,11 +8,15 @@ class Sphere : public Primitive {
   bool intersects(const Ray& ray,
                   HitRecord* hitRecord,
                   const Matrix4x4& inverseTransform) const override;
+  bool occludes(const Ray& ray, double tMax,
+                const Matrix4x4& inverseTransform) const override;
   Point3D getMinPoint(const Matrix4x4& inverseTransform) const override;
   Point3D getMaxPoint(const Matrix4x4& inverseTransform) const override;
 
   std::vector<Point3D> getBoundingBox(const Matrix4x4& inverseTransform)
       const override;
+  bool overlapsBox(const BoundingBox& box,
+                   const Matrix4x4& inverseTransform) const override;
  private:
   double solveIntersection(const Point3D& p1, const Vector3D& dir) const;
 
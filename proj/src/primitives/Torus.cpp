@@ -4,6 +4,7 @@
 #include "HitRecord.hpp"
 #include "polyroots.hpp"
 #include "Ray.hpp"
+#include "RenderCounters.hpp"
 #include "xform.hpp"
 
 using namespace primitives;
@@ -22,6 +23,7 @@ Torus::Torus(double tubeRadius_) : tubeRadius(tubeRadius_) {
 bool Torus::intersects(const Ray& ray,
                        HitRecord* hitRecord,
                        const Matrix4x4& inverseTransform) const {
+  counters::countIntersects(RenderCounters::TORUS);
   // New ray
   const auto p1 = inverseTransform * ray.start;
   const auto p2 = inverseTransform * ray.other;
@@ -44,6 +46,15 @@ bool Torus::intersects(const Ray& ray,
   return hitRecord->update(norm, globalPoint, t);
 }
 
+bool Torus::occludes(const Ray& ray, double tMax,
+                     const Matrix4x4& inverseTransform) const {
+  counters::countOccludes(RenderCounters::TORUS);
+  const Ray localRay(inverseTransform * ray.start,
+                     inverseTransform * ray.other);
+  const double t = solveIntersection(localRay);
+  return isValid(t) && t < tMax;
+}
+
 double Torus::solveIntersection(const Ray& localRay) const {
   // can be up to 4 intersections: a quartic.
   // See: http://www.emeyex.com/site/projects/raytorus.pdf
@@ -39,11 +39,15 @@
 
 #include <iostream>
 #include <cctype>
+#include <chrono>
 #include <cstring>
 #include <cstdio>
+#include <memory>
 #include <vector>
 
 #include "lua488.hpp"
+#include "ObjLoader.hpp"
+#include "TraceRecorder.hpp"
 #include "lights/AreaLight.hpp"
 #include "lights/Light.hpp"
 #include "materials/ColourMaterial.hpp"
@@ -58,6 +62,7 @@
 
 // Global options switch (lol)
 RayTracer::Options rayTracerOptions;
+SceneOverrides sceneOverrides;
 
 // Uncomment the following line to enable debugging messages
 // #define GRLUA_ENABLE_DEBUG
@@ -101,6 +106,42 @@ struct gr_light_ud {
   Light* light;
 };
 
+// The "userdata" type for a mesh read from an OBJ file. The mesh is owned
+// by the OBJ cache and the scene (see sceneMeshes).
+struct gr_obj_ud {
+  Mesh* mesh;
+};
+
+// Meshes from the OBJ cache that the current scene uses. The cache drops
+// a mesh when its file changes, so they are held here until the next scene
+// is loaded, like the rest of the scene.
+static std::vector<std::shared_ptr<Mesh>> sceneMeshes;
+
+// When the script started, or last finished rendering. What comes between
+// that and a render counts as loading the scene.
+static std::chrono::steady_clock::time_point sceneStart;
+// The scene file being run, for the renders it asks for
+static std::string sceneFile;
+// Set if one of those renders could not be done at all
+static bool renderFailed = false;
+
+// Count the time since sceneStart as loading the scene, if stats are kept
+// or a trace recorded
+static void countSceneLoad(const RayTracer::Options& options) {
+  trace::record("Load scene", sceneStart);
+  if (options.stats) {
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - sceneStart;
+    options.stats->sceneLoad += elapsed.count();
+  }
+}
+
+// Replace the size a scene asks for, if it is overridden
+static void overrideSize(int* width, int* height) {
+  if (sceneOverrides.width > 0) *width = sceneOverrides.width;
+  if (sceneOverrides.height > 0) *height = sceneOverrides.height;
+}
+
 // Useful function to retrieve and check an n-tuple of numbers.
 template<typename T>
 void get_tuple(lua_State* L, int arg, T* data, int n)
@@ -236,6 +277,18 @@ int gr_mesh_cmd(lua_State* L) {
 
   const char* name = luaL_checkstring(L, 1);
 
+  // Either a mesh from readobj, or its vertices, normals and faces
+  if (lua_isuserdata(L, 2)) {
+    gr_obj_ud* obj = (gr_obj_ud*)luaL_checkudata(L, 2, "gr.obj");
+    luaL_argcheck(L, obj->mesh != 0, 2, "Mesh expected");
+    data->node = new GeometryNode(name, obj->mesh);
+
+    luaL_getmetatable(L, "gr.node");
+    lua_setmetatable(L, -2);
+
+    return 1;
+  }
+
   std::vector<Point3D> verts;
   std::vector<std::vector<std::vector<int>>> faces;
   std::vector<Vector3D> normals;
@@ -314,6 +367,29 @@ int gr_mesh_cmd(lua_State* L) {
   return 1;
 }
 
+// Read an OBJ file into a mesh for gr.mesh. Much faster than readobj from
+// readobj.lua, and unchanged files are only read once per process.
+extern "C"
+int gr_readobj_cmd(lua_State* L) {
+  GRLUA_DEBUG_CALL;
+
+  const char* filename = luaL_checkstring(L, 1);
+  auto mesh = loadObj(filename);
+  if (!mesh) {
+    lua_pushnil(L);
+    return 1;
+  }
+  sceneMeshes.push_back(mesh);
+
+  gr_obj_ud* data = (gr_obj_ud*)lua_newuserdata(L, sizeof(gr_obj_ud));
+  data->mesh = mesh.get();
+
+  luaL_newmetatable(L, "gr.obj");
+  lua_setmetatable(L, -2);
+
+  return 1;
+}
+
 // Make a point light
 extern "C"
 int gr_area_light_cmd(lua_State* L) {
@@ -370,6 +446,50 @@ int gr_light_cmd(lua_State* L) {
   return 1;
 }
 
+// Retrieve and check a table of lights
+std::list<Light*> get_lights(lua_State* L, int arg)
+{
+  luaL_checktype(L, arg, LUA_TTABLE);
+  int light_count = luaL_getn(L, arg);
+
+  luaL_argcheck(L, light_count >= 1, arg, "Tuple of lights expected");
+  std::list<Light*> lights;
+  for (int i = 1; i <= light_count; i++) {
+    lua_rawgeti(L, arg, i);
+    gr_light_ud* ldata = (gr_light_ud*)luaL_checkudata(L, -1, "gr.light");
+    luaL_argcheck(L, ldata != 0, arg, "Light expected");
+
+    lights.push_back(ldata->light);
+    lua_pop(L, 1);
+  }
+  return lights;
+}
+
+// The options for a render. Optionally, arg is a table of limits for it:
+// {time = seconds, rays = camera rays}. They override those given on the
+// command line.
+RayTracer::Options get_options(lua_State* L, int arg)
+{
+  RayTracer::Options options = rayTracerOptions;
+  options.sceneFile = sceneFile;
+  if (!lua_isnoneornil(L, arg)) {
+    luaL_checktype(L, arg, LUA_TTABLE);
+    lua_pushstring(L, "time");
+    lua_gettable(L, arg);
+    if (!lua_isnil(L, -1)) {
+      options.timeLimit = luaL_checknumber(L, -1);
+    }
+    lua_pop(L, 1);
+    lua_pushstring(L, "rays");
+    lua_gettable(L, arg);
+    if (!lua_isnil(L, -1)) {
+      options.rayLimit = luaL_checknumber(L, -1);
+    }
+    lua_pop(L, 1);
+  }
+  return options;
+}
+
 // Render a scene
 extern "C"
 int gr_render_cmd(lua_State* L) {
@@ -378,10 +498,14 @@ int gr_render_cmd(lua_State* L) {
   gr_node_ud* root = (gr_node_ud*)luaL_checkudata(L, 1, "gr.node");
   luaL_argcheck(L, root != 0, 1, "Root node expected");
 
-  const char* filename = luaL_checkstring(L, 2);
+  std::string filename = luaL_checkstring(L, 2);
+  if (!sceneOverrides.output.empty()) {
+    filename = sceneOverrides.output;
+  }
 
   int width = luaL_checknumber(L, 3);
   int height = luaL_checknumber(L, 4);
+  overrideSize(&width, &height);
 
   Point3D eye;
   Vector3D view, up;
@@ -396,25 +520,108 @@ int gr_render_cmd(lua_State* L) {
   get_tuple(L, 9, ambient_data, 3);
   Colour ambient(ambient_data[0], ambient_data[1], ambient_data[2]);
 
-  luaL_checktype(L, 10, LUA_TTABLE);
-  int light_count = luaL_getn(L, 10);
+  std::list<Light*> lights = get_lights(L, 10);
+  RayTracer::Options options = get_options(L, 11);
 
-  luaL_argcheck(L, light_count >= 1, 10, "Tuple of lights expected");
-  std::list<Light*> lights;
-  for (int i = 1; i <= light_count; i++) {
-    lua_rawgeti(L, 10, i);
-    gr_light_ud* ldata = (gr_light_ud*)luaL_checkudata(L, -1, "gr.light");
-    luaL_argcheck(L, ldata != 0, 10, "Light expected");
+  ViewConfig viewConfig = ViewConfig(eye, view, up, fov);
 
-    lights.push_back(ldata->light);
-    lua_pop(L, 1);
+  countSceneLoad(options);
+  RayTracer rayTracer(root->node, width, height, viewConfig, ambient, lights,
+                      options);
+  if (!rayTracer.render(filename)) {
+    renderFailed = true;
   }
+  sceneStart = std::chrono::steady_clock::now();
+  return 0;
+}
 
-  ViewConfig viewConfig = ViewConfig(eye, view, up, fov);
+// Render frames of an animation, moving the camera between them:
+//
+//   gr.render_sequence(root, 'frame%03d.png', width, height, frames,
+//                      camera, ambient, lights [, limits])
+//
+// camera(frame) gives eye, view, up and fov for frames 1 to frames, and
+// each frame is saved under the pattern as soon as it is done. Everything
+// but the camera is set up once, and any limits apply to each frame.
+extern "C"
+int gr_render_sequence_cmd(lua_State* L) {
+  GRLUA_DEBUG_CALL;
 
-  RayTracer rayTracer(root->node, width, height, viewConfig, ambient, lights,
-                      rayTracerOptions);
-  rayTracer.render(filename);
+  gr_node_ud* root = (gr_node_ud*)luaL_checkudata(L, 1, "gr.node");
+  luaL_argcheck(L, root != 0, 1, "Root node expected");
+
+  // Only one number may go into the pattern, and nothing else
+  const std::string pattern = luaL_checkstring(L, 2);
+  const size_t percent = pattern.find('%');
+  size_t end = percent + 1;
+  while (end < pattern.size() && std::isdigit(pattern[end])) end++;
+  luaL_argcheck(L, percent != std::string::npos && end < pattern.size() &&
+                pattern[end] == 'd' &&
+                pattern.find('%', end) == std::string::npos,
+                2, "Pattern with one %d expected");
+
+  int width = luaL_checknumber(L, 3);
+  int height = luaL_checknumber(L, 4);
+  int frames = luaL_checknumber(L, 5);
+  luaL_argcheck(L, frames >= 1, 5, "Frame count expected");
+  overrideSize(&width, &height);
+  luaL_checktype(L, 6, LUA_TFUNCTION);
+
+  double ambient_data[3];
+  get_tuple(L, 7, ambient_data, 3);
+  Colour ambient(ambient_data[0], ambient_data[1], ambient_data[2]);
+
+  std::list<Light*> lights = get_lights(L, 8);
+  RayTracer::Options options = get_options(L, 9);
+
+  // The camera for a frame, left on top of the stack
+  auto camera = [L] (int frame) {
+    lua_pushvalue(L, 6);
+    lua_pushnumber(L, frame);
+    lua_call(L, 1, 4);
+    const int top = lua_gettop(L);
+
+    Point3D eye;
+    Vector3D view, up;
+    get_tuple(L, top - 3, &eye[0], 3);
+    get_tuple(L, top - 2, &view[0], 3);
+    get_tuple(L, top - 1, &up[0], 3);
+    double fov = luaL_checknumber(L, top);
+    lua_pop(L, 4);
+    return ViewConfig(eye, view, up, fov);
+  };
+
+  countSceneLoad(options);
+  std::unique_ptr<RayTracer> rayTracer;
+  std::vector<char> filename(pattern.size() + 32);
+  for (int frame = 1; frame <= frames; ++frame) {
+    const auto start = std::chrono::steady_clock::now();
+    const ViewConfig viewConfig = camera(frame);
+    if (rayTracer) {
+      rayTracer->setView(viewConfig);
+    }
+    else {
+      rayTracer.reset(new RayTracer(root->node, width, height, viewConfig,
+                                    ambient, lights, options));
+    }
+    std::snprintf(filename.data(), filename.size(), pattern.c_str(), frame);
+    if (!rayTracer->render(filename.data())) {
+      renderFailed = true;
+      break;
+    }
+
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::cerr << "Frame " << frame << " of " << frames << ": "
+              << filename.data() << " in " << elapsed.count() << " s"
+              << std::endl;
+
+    if (options.cancelled && *options.cancelled) {
+      std::cerr << "Cancelled, skipping the remaining frames" << std::endl;
+      break;
+    }
+  }
+  sceneStart = std::chrono::steady_clock::now();
   return 0;
 }
 
@@ -656,12 +863,14 @@ static const luaL_reg grlib_functions[] = {
   {"cube", gr_cube_cmd},
   {"cylinder", gr_cylinder_cmd},
   {"mesh", gr_mesh_cmd},
+  {"readobj", gr_readobj_cmd},
   {"sphere", gr_sphere_cmd},
   {"torus", gr_torus_cmd},
 
   {"light", gr_light_cmd},
   {"area_light", gr_area_light_cmd},
   {"render", gr_render_cmd},
+  {"render_sequence", gr_render_sequence_cmd},
   {0, 0}
 };
 
@@ -693,6 +902,9 @@ static const luaL_reg grlib_node_methods[] = {
 // raytrace it as appropriate.
 bool run_lua(const std::string& filename) {
   GRLUA_DEBUG("Importing scene from " << filename);
+  sceneStart = std::chrono::steady_clock::now();
+  sceneFile = filename;
+  renderFailed = false;
 
   // Start a lua interpreter
   lua_State* L = lua_open();
@@ -716,6 +928,9 @@ bool run_lua(const std::string& filename) {
   // Load the gr functions
   luaL_openlib(L, "gr", grlib_functions, 0);
 
+  // The last scene has been rendered, so its meshes can go
+  sceneMeshes.clear();
+
   GRLUA_DEBUG("Parsing the scene");
   // Now parse the actual scene
   if (luaL_loadfile(L, filename.c_str()) || lua_pcall(L, 0, 0, 0)) {
@@ -727,5 +942,5 @@ bool run_lua(const std::string& filename) {
   // Close the interpreter, free up any resources not needed
   lua_close(L);
 
-  return true;
+  return !renderFailed;
 }
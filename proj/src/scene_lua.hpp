@@ -7,4 +7,16 @@
 
 extern RayTracer::Options rayTracerOptions;
 
+// For running scenes as they are, but at another size or saved elsewhere,
+// as benchmarks do. 0 or empty leaves what the scene asks for.
+struct SceneOverrides {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  // Where gr.render saves the image
+  std::string output;
+};
+extern SceneOverrides sceneOverrides;
+
+// Run the scene in filename, doing the renders it asks for. Returns false
+// if it could not be run, or one of its renders could not be done.
 bool run_lua(const std::string& filename);
@@ -0,0 +1,388 @@
+// Renders the bundled scenes with fixed sizes and options, and reports where
+// the time went, so that changes can be checked for slowdowns.
+//
+// Usage: rt-bench [options] [case ...]
+//
+// Each case is rendered in a process of its own, so that it starts cold and
+// its peak memory is its own. The report is JSON, one case to a line. Given
+// a baseline report, cases that got slower or bigger than it by more than
+// the threshold fail the run.
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "LocalSocket.hpp"
+#include "RayTracer.hpp"
+#include "RenderStats.hpp"
+#include "scene_lua.hpp"
+
+namespace {
+
+struct Case {
+  const char* name;
+  const char* scene;
+  uint32_t size;
+  void (*setup)(RayTracer::Options* options);
+};
+
+const Case CASES[] = {
+  {"grid-bvh", "grid.lua", 256, [] (RayTracer::Options* options) {
+    options->boundingVolumeHierarchy = true;
+  }},
+  {"grid-uniform", "grid.lua", 256, [] (RayTracer::Options* options) {
+    options->uniformGrid = true;
+  }},
+  {"glossy", "glossy.lua", 256, [] (RayTracer::Options* options) {
+    options->boundingVolumeHierarchy = true;
+    options->glossyReflection = 4;
+  }},
+  {"soft", "soft.lua", 256, [] (RayTracer::Options* options) {
+    options->boundingVolumeHierarchy = true;
+    options->shadowSamples = 4;
+  }},
+  {"trans-aa", "trans.lua", 256, [] (RayTracer::Options* options) {
+    options->boundingVolumeHierarchy = true;
+    options->aaDepth = 2;
+  }},
+  {"monkey-levels", "monkey.lua", 256, [] (RayTracer::Options* options) {
+    options->uniformGrid = true;
+    options->splitMeshes = true;
+    options->uniformGridLevels = 2;
+    options->phongInterpolation = true;
+  }},
+  {"monkey-bvh", "monkey.lua", 256, [] (RayTracer::Options* options) {
+    options->boundingVolumeHierarchy = true;
+    options->phongInterpolation = true;
+  }},
+  // final_box.lua is only the room; this is the scene built in it
+  {"final-scene", "final_scene.lua", 256, [] (RayTracer::Options* options) {
+    options->boundingVolumeHierarchy = true;
+    options->phongInterpolation = true;
+  }},
+};
+
+// What a case's process sends back
+struct Result {
+  bool ok;
+  double seconds;
+  RenderStats stats;
+  // In kilobytes
+  long peakRss;
+};
+
+struct Settings {
+  std::string dataDir = "../data";
+  uint32_t threads = RayTracer::defaultThreadCount();
+  int runs = 1;
+  bool verbose = false;
+};
+
+// Render c in a child process, in the data directory
+bool runCase(const Case& c, const Settings& settings, Result* result) {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+    std::cerr << "Could not make a socket pair: " << std::strerror(errno)
+              << std::endl;
+    return false;
+  }
+
+  const pid_t pid = fork();
+  if (pid < 0) {
+    std::cerr << "Could not fork: " << std::strerror(errno) << std::endl;
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+  }
+
+  if (pid == 0) {
+    close(fds[0]);
+    Result mine = {};
+    if (chdir(settings.dataDir.c_str()) != 0) {
+      std::cerr << "Could not change to " << settings.dataDir << ": "
+                << std::strerror(errno) << std::endl;
+      _exit(1);
+    }
+    if (!settings.verbose) {
+      const int null = open("/dev/null", O_WRONLY);
+      dup2(null, STDERR_FILENO);
+      close(null);
+    }
+
+    const char* tmp = std::getenv("TMPDIR");
+    const std::string output = std::string(tmp ? tmp : "/tmp") +
+                               "/rt-bench-" + std::to_string(getpid()) +
+                               ".png";
+    sceneOverrides.width = c.size;
+    sceneOverrides.height = c.size;
+    sceneOverrides.output = output;
+    c.setup(&rayTracerOptions);
+    rayTracerOptions.threadCount = settings.threads;
+    rayTracerOptions.stats = &mine.stats;
+
+    const auto start = std::chrono::steady_clock::now();
+    mine.ok = run_lua(c.scene) && mine.stats.renders > 0;
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    mine.seconds = elapsed.count();
+    unlink(output.c_str());
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    mine.peakRss = usage.ru_maxrss;
+    _exit(sendAll(fds[1], &mine, sizeof(mine)) ? 0 : 1);
+  }
+
+  close(fds[1]);
+  const bool received = receiveAll(fds[0], result, sizeof(*result));
+  close(fds[0]);
+  int status;
+  waitpid(pid, &status, 0);
+  return received && result->ok && WIFEXITED(status) &&
+         WEXITSTATUS(status) == 0;
+}
+
+double raysPerSecond(const Result& result) {
+  const double tracing = result.stats.trace + result.stats.antialias;
+  return tracing > 0 ? result.stats.cameraRays / tracing : 0;
+}
+
+std::string toJson(const Case& c, const Result& result) {
+  const auto& stats = result.stats;
+  std::ostringstream out;
+  out << "{\"name\": \"" << c.name << "\", \"scene\": \"" << c.scene
+      << "\", \"size\": " << c.size << ", \"seconds\": " << result.seconds
+      << ", \"camera_rays\": " << stats.cameraRays
+      << ", \"rays_per_second\": " << (uint64_t) raysPerSecond(result)
+      << ", \"phases\": {\"lua_load\": " << stats.sceneLoad
+      << ", \"extraction\": " << stats.extraction
+      << ", \"accel_build\": " << stats.accelBuild
+      << ", \"trace\": " << stats.trace
+      << ", \"antialias\": " << stats.antialias
+      << ", \"png_encode\": " << stats.pngEncode
+      << "}, \"peak_rss_kb\": " << result.peakRss << "}";
+  return out.str();
+}
+
+// The value after "key": in a line of a report
+bool findValue(const std::string& line, const std::string& key,
+               std::string* value) {
+  const std::string quoted = "\"" + key + "\": ";
+  const size_t found = line.find(quoted);
+  if (found == std::string::npos) return false;
+  size_t start = found + quoted.size();
+  size_t end;
+  if (line[start] == '"') {
+    start += 1;
+    end = line.find('"', start);
+  }
+  else {
+    end = line.find_first_of(",}", start);
+  }
+  if (end == std::string::npos) return false;
+  *value = line.substr(start, end - start);
+  return true;
+}
+
+struct Baseline {
+  double seconds;
+  long peakRss;
+};
+
+// The cases in a report written by an earlier run, by name
+bool readBaseline(const std::string& filename,
+                  std::map<std::string, Baseline>* baseline) {
+  std::ifstream in(filename);
+  if (!in) {
+    std::cerr << "Could not open baseline " << filename << std::endl;
+    return false;
+  }
+  std::string line;
+  while (std::getline(in, line)) {
+    std::string name, seconds, rss;
+    if (findValue(line, "name", &name) &&
+        findValue(line, "seconds", &seconds) &&
+        findValue(line, "peak_rss_kb", &rss)) {
+      (*baseline)[name] = {std::stod(seconds), std::stol(rss)};
+    }
+  }
+  return true;
+}
+
+// Whether now is worse than before by more than threshold, saying so
+bool regressed(const std::string& name, const std::string& what,
+               double before, double now, double threshold) {
+  const double change = before > 0 ? now / before - 1 : 0;
+  const bool worse = change > threshold;
+  std::cerr << (worse ? "REGRESSED " : "          ") << name << " " << what
+            << ": " << before << " -> " << now << " ("
+            << (change >= 0 ? "+" : "") << (int) (change * 100) << "%)"
+            << std::endl;
+  return worse;
+}
+
+} // Anonymous
+
+int main(int argc, char** argv) {
+  auto printUsage = [&] () {
+    std::cerr
+      << "Usage: " << argv[0] << " [options] [case ...]" << std::endl
+      << "\t-d dir: Where the scenes are (default ../data)" << std::endl
+      << "\t-o file: Write the report here instead of to stdout" << std::endl
+      << "\t-n runs: Render each case this many times, keeping the fastest"
+      << std::endl
+      << "\t-t threads: Threads per render (default one per core)"
+      << std::endl
+      << "\t-v: Show the renderer's output" << std::endl
+      << "\t--baseline file: Fail if slower or bigger than this report"
+      << std::endl
+      << "\t--threshold fraction: How much worse is too much (default 0.1)"
+      << std::endl
+      << "Cases:";
+    for (const auto& c : CASES) {
+      std::cerr << " " << c.name;
+    }
+    std::cerr << std::endl;
+  };
+
+  Settings settings;
+  std::string reportFile;
+  std::string baselineFile;
+  double threshold = 0.1;
+  std::vector<const Case*> cases;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (arg == "-d" && hasValue) {
+      settings.dataDir = argv[++i];
+    }
+    else if (arg == "-o" && hasValue) {
+      reportFile = argv[++i];
+    }
+    else if (arg == "-n" && hasValue) {
+      settings.runs = std::atoi(argv[++i]);
+    }
+    else if (arg == "-t" && hasValue) {
+      settings.threads = std::atoi(argv[++i]);
+    }
+    else if (arg == "-v") {
+      settings.verbose = true;
+    }
+    else if (arg == "--baseline" && hasValue) {
+      baselineFile = argv[++i];
+    }
+    else if (arg == "--threshold" && hasValue) {
+      threshold = std::atof(argv[++i]);
+    }
+    else if (arg[0] != '-') {
+      const Case* found = nullptr;
+      for (const auto& c : CASES) {
+        if (arg == c.name) found = &c;
+      }
+      if (!found) {
+        std::cerr << "No case " << arg << std::endl;
+        printUsage();
+        return 1;
+      }
+      cases.push_back(found);
+    }
+    else {
+      printUsage();
+      return 1;
+    }
+  }
+  if (settings.runs < 1 || settings.threads < 1 || threshold < 0) {
+    printUsage();
+    return 1;
+  }
+  if (cases.empty()) {
+    for (const auto& c : CASES) {
+      cases.push_back(&c);
+    }
+  }
+
+  std::map<std::string, Baseline> baseline;
+  if (!baselineFile.empty() && !readBaseline(baselineFile, &baseline)) {
+    return 1;
+  }
+
+  std::vector<std::string> lines;
+  bool failed = false;
+  for (const Case* c : cases) {
+    Result best;
+    bool any = false;
+    long peakRss = 0;
+    for (int run = 0; run < settings.runs; ++run) {
+      Result result;
+      if (!runCase(*c, settings, &result)) {
+        std::cerr << c->name << ": " << c->scene << " failed to render"
+                  << (settings.verbose ? "" : " (run with -v to see why)")
+                  << std::endl;
+        break;
+      }
+      peakRss = std::max(peakRss, result.peakRss);
+      if (!any || result.seconds < best.seconds) {
+        best = result;
+        any = true;
+      }
+    }
+    if (!any) {
+      failed = true;
+      continue;
+    }
+    best.peakRss = peakRss;
+
+    std::cerr << c->name << ": " << best.seconds << " s, "
+              << (uint64_t) raysPerSecond(best) << " rays/s, "
+              << best.peakRss << " KB" << std::endl;
+    lines.push_back(toJson(*c, best));
+
+    const auto found = baseline.find(c->name);
+    if (found == baseline.end()) {
+      if (!baseline.empty()) {
+        std::cerr << c->name << " is not in the baseline" << std::endl;
+      }
+      continue;
+    }
+    const bool slower = regressed(c->name, "seconds", found->second.seconds,
+                                  best.seconds, threshold);
+    const bool bigger = regressed(c->name, "peak RSS KB",
+                                  found->second.peakRss, best.peakRss,
+                                  threshold);
+    failed = failed || slower || bigger;
+  }
+
+  std::ofstream file;
+  if (!reportFile.empty()) {
+    file.open(reportFile);
+    if (!file) {
+      std::cerr << "Could not write " << reportFile << std::endl;
+      return 1;
+    }
+  }
+  std::ostream& report = reportFile.empty() ? std::cout : file;
+  report << "{\"threads\": " << settings.threads << ", \"runs\": "
+         << settings.runs << ", \"cases\": [" << std::endl;
+  for (size_t i = 0; i < lines.size(); ++i) {
+    report << "  " << lines[i] << (i + 1 < lines.size() ? "," : "")
+           << std::endl;
+  }
+  report << "]}" << std::endl;
+
+  return failed ? 1 : 0;
+}
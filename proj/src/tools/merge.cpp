@@ -0,0 +1,102 @@
+// Stitches cropped renders (rt --crop) back into one image.
+//
+// Usage: rt-merge output width height part x y [part x y ...]
+//
+// Each part is pasted with its top left corner at (x, y), the same offset it
+// was rendered with. Later parts win where they overlap.
+
+#include <algorithm>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "image.hpp"
+
+int main(int argc, char** argv) {
+  auto printUsage = [&] () {
+    std::cerr
+      << "Usage: " << argv[0] << " output width height part x y [part x y ...]"
+      << std::endl
+      << "\tPaste each part into a width x height image at (x, y)" << std::endl;
+  };
+
+  if (argc < 7 || (argc - 4) % 3 != 0) {
+    printUsage();
+    return 1;
+  }
+
+  // Where each part goes
+  struct Part {
+    std::string filename;
+    int x0, y0;
+  };
+
+  const std::string output = argv[1];
+  int width, height;
+  std::vector<Part> parts;
+  try {
+    width = std::stoi(argv[2]);
+    height = std::stoi(argv[3]);
+    for (int i = 4; i < argc; i += 3) {
+      parts.push_back({argv[i], std::stoi(argv[i + 1]),
+                       std::stoi(argv[i + 2])});
+    }
+  }
+  catch (const std::exception&) {
+    std::cerr << "Invalid number" << std::endl;
+    printUsage();
+    return 1;
+  }
+  if (width <= 0 || height <= 0) {
+    std::cerr << "Invalid size: " << width << "x" << height << std::endl;
+    return 1;
+  }
+
+  Image merged(width, height, 3);
+  std::vector<bool> covered(width * height, false);
+
+  for (const auto& where : parts) {
+    const std::string& filename = where.filename;
+    const int x0 = where.x0;
+    const int y0 = where.y0;
+
+    Image part;
+    if (!part.loadPng(filename)) {
+      std::cerr << "Could not open " << filename << std::endl;
+      return 1;
+    }
+    if (x0 < 0 || y0 < 0 ||
+        x0 + part.width() > width || y0 + part.height() > height) {
+      std::cerr << filename << " (" << part.width() << "x" << part.height()
+                << ") does not fit at (" << x0 << ", " << y0 << ")"
+                << std::endl;
+      return 1;
+    }
+
+    // Grey parts have one element per pixel, and any alpha is dropped
+    const int last = std::min(part.elements(), 3) - 1;
+    for (int y = 0; y < part.height(); ++y) {
+      for (int x = 0; x < part.width(); ++x) {
+        for (int c = 0; c < 3; ++c) {
+          merged(x0 + x, y0 + y, c) = part(x, y, std::min(c, last));
+        }
+        covered[(y0 + y) * width + x0 + x] = true;
+      }
+    }
+  }
+
+  size_t missing = 0;
+  for (bool c : covered) {
+    if (!c) missing += 1;
+  }
+  if (missing > 0) {
+    std::cerr << "Warning: " << missing << " pixels are in no part"
+              << std::endl;
+  }
+
+  if (!merged.savePng(output)) {
+    std::cerr << "Could not write " << output << std::endl;
+    return 1;
+  }
+}
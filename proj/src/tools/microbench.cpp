@@ -0,0 +1,309 @@
+// Times the intersection kernels on their own: each primitive's intersects
+// and occludes, and the polynomial root finders behind them.
+//
+// Usage: rt-microbench [-n calls] [-s seed] [-m mesh.obj]
+//
+// Primitives get random rays aimed near them, and report the time per call,
+// how many hit, and how often occludes disagrees with intersects. The root
+// finders get random polynomials built from known roots, and report the
+// time per call and how far the roots they find are from the true roots of
+// the (rounded) coefficients, found in long double.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "algebra.hpp"
+#include "HitRecord.hpp"
+#include "ObjLoader.hpp"
+#include "polyroots.hpp"
+#include "primitives/Cube.hpp"
+#include "primitives/Cylinder.hpp"
+#include "primitives/Mesh.hpp"
+#include "primitives/Sphere.hpp"
+#include "primitives/Torus.hpp"
+#include "Ray.hpp"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double nanosecondsPer(Clock::time_point start, size_t calls) {
+  const std::chrono::duration<double, std::nano> elapsed =
+      Clock::now() - start;
+  return elapsed.count() / calls;
+}
+
+// Keeps results alive, so that timed loops are not optimised away
+volatile double sink;
+
+void printRow(const std::string& name, double ns, const std::string& rest) {
+  std::cout << std::left << std::setw(22) << name << std::right
+            << std::setw(9) << std::fixed << std::setprecision(1) << ns
+            << " ns/call  " << rest << std::endl;
+}
+
+// Rays from a sphere of radius 5 around the primitive, aimed at points in
+// its bounding box grown by a fifth on every side, so that some miss
+std::vector<Ray> randomRays(const Primitive& primitive, size_t count,
+                            std::mt19937_64* random) {
+  const Matrix4x4 identity;
+  const auto minPoint = primitive.getMinPoint(identity);
+  const auto maxPoint = primitive.getMaxPoint(identity);
+  std::uniform_real_distribution<double> unit(0, 1);
+  std::normal_distribution<double> normal(0, 1);
+
+  std::vector<Ray> rays;
+  rays.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    Vector3D from(normal(*random), normal(*random), normal(*random));
+    from.normalize();
+    Point3D start, target;
+    for (int j = 0; j < 3; ++j) {
+      const double centre = (minPoint[j] + maxPoint[j]) / 2;
+      const double size = (maxPoint[j] - minPoint[j]) * 1.4;
+      start[j] = centre + 5 * from[j];
+      target[j] = centre + size * (unit(*random) - 0.5);
+    }
+    rays.emplace_back(start, target);
+  }
+  return rays;
+}
+
+void benchPrimitive(const std::string& name, const Primitive& primitive,
+                    size_t count, std::mt19937_64* random) {
+  const auto rays = randomRays(primitive, count, random);
+  const Matrix4x4 identity;
+  const double tMax = std::numeric_limits<double>::infinity();
+
+  std::vector<char> hits(count);
+  double total = 0;
+  auto start = Clock::now();
+  for (size_t i = 0; i < count; ++i) {
+    HitRecord hitRecord;
+    hits[i] = primitive.intersects(rays[i], &hitRecord, identity);
+    total += hitRecord.t;
+  }
+  const double intersectNs = nanosecondsPer(start, count);
+
+  std::vector<char> occluded(count);
+  start = Clock::now();
+  for (size_t i = 0; i < count; ++i) {
+    occluded[i] = primitive.occludes(rays[i], tMax, identity);
+  }
+  const double occludeNs = nanosecondsPer(start, count);
+  sink = total;
+
+  size_t hitCount = 0;
+  size_t disagreements = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (hits[i]) hitCount += 1;
+    if (hits[i] != occluded[i]) disagreements += 1;
+  }
+  std::ostringstream hitRate;
+  hitRate << std::fixed << std::setprecision(1)
+          << 100.0 * hitCount / count << "% hit";
+  printRow(name + " intersects", intersectNs, hitRate.str());
+  printRow(name + " occludes", occludeNs,
+           std::to_string(disagreements) + " disagree with intersects");
+}
+
+// A polynomial of up to degree 4, highest power first, and its real roots
+struct Polynomial {
+  int degree;
+  double coefficients[5];
+  size_t rootCount;
+  long double roots[4];
+};
+
+std::vector<long double> multiply(const std::vector<long double>& a,
+                                  const std::vector<long double>& b) {
+  std::vector<long double> product(a.size() + b.size() - 1, 0);
+  for (size_t i = 0; i < a.size(); ++i) {
+    for (size_t j = 0; j < b.size(); ++j) {
+      product[i + j] += a[i] * b[j];
+    }
+  }
+  return product;
+}
+
+// The product of (x - root) for each real root and a quadratic with no real
+// roots for each complex pair, with a random leading coefficient unless it
+// is monic
+Polynomial makePolynomial(int realRoots, int complexPairs, bool monic,
+                          std::mt19937_64* random) {
+  std::uniform_real_distribution<double> root(-10, 10);
+  std::uniform_real_distribution<double> scale(0.5, 2);
+  Polynomial polynomial;
+  polynomial.degree = realRoots + 2 * complexPairs;
+  polynomial.rootCount = realRoots;
+  std::vector<long double> product = {monic ? 1 : scale(*random)};
+  for (int i = 0; i < realRoots; ++i) {
+    const long double r = root(*random);
+    product = multiply(product, {1, -r});
+    polynomial.roots[i] = r;
+  }
+  for (int i = 0; i < complexPairs; ++i) {
+    // (x - re)^2 + im^2
+    const long double re = root(*random);
+    const long double im = scale(*random);
+    product = multiply(product, {1, -2 * re, re * re + im * im});
+  }
+  for (int i = 0; i <= polynomial.degree; ++i) {
+    polynomial.coefficients[i] = (double) product[i];
+  }
+
+  // Rounding the coefficients moved the roots a little. Polish them against
+  // the rounded coefficients, so the reference is what a perfect solver
+  // would find.
+  for (size_t i = 0; i < polynomial.rootCount; ++i) {
+    long double& r = polynomial.roots[i];
+    for (int step = 0; step < 8; ++step) {
+      long double value = 0, slope = 0;
+      for (int j = 0; j <= polynomial.degree; ++j) {
+        slope = slope * r + value;
+        value = value * r + polynomial.coefficients[j];
+      }
+      if (slope == 0) break;
+      r -= value / slope;
+    }
+  }
+  return polynomial;
+}
+
+// solve(coefficients, roots) returns the number of roots it found
+template <typename Solve>
+void benchRoots(const std::string& name,
+                const std::vector<Polynomial>& polynomials, Solve solve) {
+  std::vector<double> found(polynomials.size() * 4);
+  std::vector<size_t> counts(polynomials.size());
+  const auto start = Clock::now();
+  for (size_t i = 0; i < polynomials.size(); ++i) {
+    counts[i] = solve(polynomials[i].coefficients, &found[4 * i]);
+  }
+  const double ns = nanosecondsPer(start, polynomials.size());
+
+  // Compare each true root with the closest one found
+  size_t wrongCount = 0;
+  size_t compared = 0;
+  double worst = 0, sum = 0;
+  for (size_t i = 0; i < polynomials.size(); ++i) {
+    const auto& polynomial = polynomials[i];
+    if (counts[i] != polynomial.rootCount) {
+      wrongCount += 1;
+    }
+    if (counts[i] == 0) continue;
+    for (size_t k = 0; k < polynomial.rootCount; ++k) {
+      const long double r = polynomial.roots[k];
+      double error = std::numeric_limits<double>::infinity();
+      for (size_t j = 0; j < counts[i]; ++j) {
+        error = std::min(error, (double) (std::fabs(found[4 * i + j] - r) /
+                                          std::max(1.0L, std::fabs(r))));
+      }
+      worst = std::max(worst, error);
+      sum += error;
+      compared += 1;
+    }
+  }
+  sink = sum;
+
+  std::ostringstream rest;
+  rest << std::scientific << std::setprecision(2) << "relative error "
+       << (compared ? sum / compared : 0) << " mean, " << worst << " worst, "
+       << wrongCount << " wrong root counts";
+  printRow(name, ns, rest.str());
+}
+
+} // Anonymous
+
+int main(int argc, char** argv) {
+  auto printUsage = [&] () {
+    std::cerr
+      << "Usage: " << argv[0] << " [-n calls] [-s seed] [-m mesh.obj]"
+      << std::endl
+      << "\t-n: Calls to time each kernel with. Default 1000000." << std::endl
+      << "\t-s: Seed for the random rays and polynomials." << std::endl
+      << "\t-m: Mesh to fire rays at. Default ../data/suzanne.obj."
+      << std::endl;
+  };
+
+  size_t count = 1000000;
+  uint64_t seed = 488;
+  std::string meshFile = "../data/suzanne.obj";
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      printUsage();
+      return 1;
+    }
+    if (arg == "-n") {
+      count = std::stoul(argv[++i]);
+    }
+    else if (arg == "-s") {
+      seed = std::stoull(argv[++i]);
+    }
+    else if (arg == "-m") {
+      meshFile = argv[++i];
+    }
+    else {
+      printUsage();
+      return 1;
+    }
+  }
+  if (count == 0) {
+    printUsage();
+    return 1;
+  }
+
+  std::mt19937_64 random(seed);
+  std::cout << count << " calls each" << std::endl;
+
+  benchPrimitive("sphere", Sphere(), count, &random);
+  benchPrimitive("cube", Cube(), count, &random);
+  benchPrimitive("cylinder", Cylinder(), count, &random);
+  benchPrimitive("torus", Torus(0.25), count, &random);
+  const auto mesh = loadObj(meshFile);
+  if (mesh) {
+    benchPrimitive("mesh", *mesh, count, &random);
+  }
+  else {
+    std::cerr << "Could not load " << meshFile << ", skipping the mesh"
+              << std::endl;
+  }
+
+  // Real roots and complex pairs of each kind of polynomial, in turn
+  auto polynomials = [&] (const std::vector<std::pair<int, int>>& shapes,
+                          bool monic) {
+    std::vector<Polynomial> made;
+    made.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+      const auto& shape = shapes[i % shapes.size()];
+      made.push_back(
+          makePolynomial(shape.first, shape.second, monic, &random));
+    }
+    return made;
+  };
+
+  benchRoots("quadraticRoots",
+             polynomials({{2, 0}, {2, 0}, {2, 0}, {0, 1}}, false),
+             [] (const double* c, double* roots) {
+    return quadraticRoots(c[0], c[1], c[2], roots);
+  });
+  benchRoots("cubicRoots", polynomials({{3, 0}, {1, 1}}, true),
+             [] (const double* c, double* roots) {
+    return cubicRoots(c[1], c[2], c[3], roots);
+  });
+  benchRoots("quarticRoots",
+             polynomials({{4, 0}, {4, 0}, {2, 1}, {2, 1}, {0, 2}}, true),
+             [] (const double* c, double* roots) {
+    return quarticRoots(c[1], c[2], c[3], c[4], roots);
+  });
+}